@@ -0,0 +1,316 @@
+#include "postgres.h"
+
+#include <pthread.h>
+#include <git2.h>
+
+#include "port/atomics.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "allocator.h"
+
+#if (LIBGIT2_VER_MAJOR >= 1 || LIBGIT2_VER_MINOR >= 28) && (PG_VERSION_NUM >= 90500)
+#include <git2/sys/alloc.h>
+#define HAVE_GIT_ALLOCATOR
+#endif
+
+/* In kB, 0 for no limit */
+static int git_fdw_memory_limit = 0;
+
+#ifdef HAVE_GIT_ALLOCATOR
+
+/*
+ * Precedes every block handed to libgit2. Blocks allocated on the backend's
+ * thread come from libgit2_context; other threads (libgit2 may be driven
+ * from helper threads) can't touch memory contexts and get malloc'd blocks.
+ */
+typedef struct GitFdwChunk
+{
+  size_t size;              /* what libgit2 asked for */
+  bool pooled;              /* palloc'd in libgit2_context */
+  struct GitFdwChunk *next; /* in deferred_frees */
+} GitFdwChunk;
+
+#define CHUNK_HEADER_SIZE MAXALIGN(sizeof(GitFdwChunk))
+#define CHUNK_DATA(chunk) ((void *)((char *)(chunk) + CHUNK_HEADER_SIZE))
+#define DATA_CHUNK(ptr) ((GitFdwChunk *)((char *)(ptr)-CHUNK_HEADER_SIZE))
+
+static MemoryContext libgit2_context = NULL;
+static pthread_t backend_thread;
+
+/* Bytes held in libgit2_context, only touched by the backend's thread */
+static uint64 pooled_bytes = 0;
+/* Bytes malloc'd by other threads */
+static pg_atomic_uint64 malloced_bytes;
+/* Size of the last allocation the limit refused, 0 if none since the last check */
+static pg_atomic_uint64 refused_bytes;
+
+/* Pooled blocks freed by other threads, released by the backend's thread */
+static pthread_mutex_t deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static GitFdwChunk *deferred_frees = NULL;
+
+static git_allocator allocator;
+
+static bool gitAllocatorOnBackendThread(void)
+{
+  return pthread_equal(pthread_self(), backend_thread);
+}
+
+static void gitAllocatorReleaseDeferred(void)
+{
+  GitFdwChunk *chunk;
+
+  /* Unlocked peek, a block missed now gets released next time */
+  if (deferred_frees == NULL)
+    return;
+
+  pthread_mutex_lock(&deferred_lock);
+  chunk = deferred_frees;
+  deferred_frees = NULL;
+  pthread_mutex_unlock(&deferred_lock);
+
+  while (chunk != NULL)
+  {
+    GitFdwChunk *next = chunk->next;
+
+    pooled_bytes -= chunk->size;
+    pfree(chunk);
+    chunk = next;
+  }
+}
+
+static void *gitAllocatorMalloc(size_t n, const char *file, int line)
+{
+  GitFdwChunk *chunk;
+  uint64 limit = (uint64)git_fdw_memory_limit * 1024;
+  bool on_backend_thread = gitAllocatorOnBackendThread();
+
+  if (on_backend_thread)
+    gitAllocatorReleaseDeferred();
+
+  /* pooled_bytes may be stale when read from another thread, that's fine */
+  if (limit > 0 && pooled_bytes + pg_atomic_read_u64(&malloced_bytes) + n > limit)
+  {
+    pg_atomic_write_u64(&refused_bytes, Max(n, 1));
+    return NULL;
+  }
+
+  if (on_backend_thread)
+  {
+    if (libgit2_context == NULL)
+      libgit2_context = AllocSetContextCreate(TopMemoryContext,
+                                              "git_fdw libgit2",
+                                              ALLOCSET_DEFAULT_MINSIZE,
+                                              ALLOCSET_DEFAULT_INITSIZE,
+                                              ALLOCSET_DEFAULT_MAXSIZE);
+
+    /* Erroring out from within libgit2 would leave its locks held */
+    chunk = (GitFdwChunk *)MemoryContextAllocExtended(libgit2_context,
+                                                      CHUNK_HEADER_SIZE + n,
+                                                      MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
+    if (chunk == NULL)
+      return NULL;
+    chunk->pooled = true;
+    pooled_bytes += n;
+  }
+  else
+  {
+    chunk = (GitFdwChunk *)malloc(CHUNK_HEADER_SIZE + n);
+    if (chunk == NULL)
+      return NULL;
+    chunk->pooled = false;
+    pg_atomic_fetch_add_u64(&malloced_bytes, n);
+  }
+
+  chunk->size = n;
+  chunk->next = NULL;
+  return CHUNK_DATA(chunk);
+}
+
+static void gitAllocatorFree(void *ptr)
+{
+  GitFdwChunk *chunk;
+
+  if (ptr == NULL)
+    return;
+
+  chunk = DATA_CHUNK(ptr);
+  if (!chunk->pooled)
+  {
+    pg_atomic_fetch_sub_u64(&malloced_bytes, chunk->size);
+    free(chunk);
+  }
+  else if (gitAllocatorOnBackendThread())
+  {
+    pooled_bytes -= chunk->size;
+    pfree(chunk);
+  }
+  else
+  {
+    pthread_mutex_lock(&deferred_lock);
+    chunk->next = deferred_frees;
+    deferred_frees = chunk;
+    pthread_mutex_unlock(&deferred_lock);
+  }
+}
+
+static void *gitAllocatorRealloc(void *ptr, size_t size, const char *file, int line)
+{
+  void *copy;
+
+  if (ptr == NULL)
+    return gitAllocatorMalloc(size, file, line);
+
+  /* The block may have come from another thread, so always move it */
+  copy = gitAllocatorMalloc(size, file, line);
+  if (copy == NULL)
+    return NULL;
+  memcpy(copy, ptr, Min(size, DATA_CHUNK(ptr)->size));
+  gitAllocatorFree(ptr);
+  return copy;
+}
+
+#if LIBGIT2_VER_MAJOR < 1 || (LIBGIT2_VER_MAJOR == 1 && LIBGIT2_VER_MINOR < 4)
+/* libgit2 < 1.4 wants every variant, later versions derive them */
+static void *gitAllocatorMallocArray(size_t nelem, size_t elsize, const char *file, int line)
+{
+  if (elsize != 0 && nelem > SIZE_MAX / elsize)
+    return NULL;
+  return gitAllocatorMalloc(nelem * elsize, file, line);
+}
+
+static void *gitAllocatorCalloc(size_t nelem, size_t elsize, const char *file, int line)
+{
+  void *ptr = gitAllocatorMallocArray(nelem, elsize, file, line);
+
+  if (ptr != NULL)
+    memset(ptr, 0, nelem * elsize);
+  return ptr;
+}
+
+static char *gitAllocatorSubstrdup(const char *str, size_t n, const char *file, int line)
+{
+  char *copy;
+
+  if (n == SIZE_MAX)
+    return NULL;
+  copy = (char *)gitAllocatorMalloc(n + 1, file, line);
+  if (copy != NULL)
+  {
+    memcpy(copy, str, n);
+    copy[n] = '\0';
+  }
+  return copy;
+}
+
+static char *gitAllocatorStrdup(const char *str, const char *file, int line)
+{
+  return gitAllocatorSubstrdup(str, strlen(str), file, line);
+}
+
+static char *gitAllocatorStrndup(const char *str, size_t n, const char *file, int line)
+{
+  return gitAllocatorSubstrdup(str, strnlen(str, n), file, line);
+}
+
+static void *gitAllocatorReallocArray(void *ptr, size_t nelem, size_t elsize, const char *file, int line)
+{
+  if (elsize != 0 && nelem > SIZE_MAX / elsize)
+    return NULL;
+  return gitAllocatorRealloc(ptr, nelem * elsize, file, line);
+}
+#endif
+
+#endif /* HAVE_GIT_ALLOCATOR */
+
+void gitAllocatorInit(void)
+{
+  DefineCustomIntVariable("git_fdw.memory_limit",
+                          "Sets the maximum memory libgit2 may use in a backend.",
+                          "0 means no limit.",
+                          &git_fdw_memory_limit,
+                          0,
+                          0,
+                          INT_MAX,
+                          PGC_SUSET,
+                          GUC_UNIT_KB,
+                          NULL,
+                          NULL,
+                          NULL);
+
+#ifdef HAVE_GIT_ALLOCATOR
+  /* Forked backends inherit the thread id along with the rest */
+  backend_thread = pthread_self();
+  pg_atomic_init_u64(&malloced_bytes, 0);
+  pg_atomic_init_u64(&refused_bytes, 0);
+
+  allocator.gmalloc = gitAllocatorMalloc;
+  allocator.grealloc = gitAllocatorRealloc;
+  allocator.gfree = gitAllocatorFree;
+#if LIBGIT2_VER_MAJOR < 1 || (LIBGIT2_VER_MAJOR == 1 && LIBGIT2_VER_MINOR < 4)
+  allocator.gcalloc = gitAllocatorCalloc;
+  allocator.gstrdup = gitAllocatorStrdup;
+  allocator.gstrndup = gitAllocatorStrndup;
+  allocator.gsubstrdup = gitAllocatorSubstrdup;
+  allocator.greallocarray = gitAllocatorReallocArray;
+  allocator.gmallocarray = gitAllocatorMallocArray;
+#endif
+
+  /* Has to happen before libgit2 allocates anything */
+  if (git_libgit2_opts(GIT_OPT_SET_ALLOCATOR, &allocator) < 0)
+    ereport(WARNING,
+            (errmsg("could not route libgit2 allocations through git_fdw"),
+             errdetail("git_fdw.memory_limit will not be enforced.")));
+#endif
+}
+
+/* Raise the error libgit2 only reported as a failed call */
+void gitAllocatorCheckLimit(void)
+{
+#ifdef HAVE_GIT_ALLOCATOR
+  uint64 refused = pg_atomic_exchange_u64(&refused_bytes, 0);
+
+  if (refused == 0)
+    return;
+
+  ereport(ERROR,
+          (errcode(ERRCODE_OUT_OF_MEMORY),
+           errmsg("out of memory"),
+           errdetail("libgit2 failed on request of size " UINT64_FORMAT " with " UINT64_FORMAT " bytes in use.",
+                     refused, (uint64)gitAllocatorUsage()),
+           errhint("Consider increasing git_fdw.memory_limit (currently %dkB).",
+                   git_fdw_memory_limit)));
+#endif
+}
+
+/* Bytes libgit2 currently holds, 0 when they aren't tracked */
+int64 gitAllocatorUsage(void)
+{
+#ifdef HAVE_GIT_ALLOCATOR
+  return (int64)(pooled_bytes + pg_atomic_read_u64(&malloced_bytes));
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Pairs with git_libgit2_init(). Once libgit2 has torn down its global state
+ * nothing it allocated is alive any more, so whatever handle an aborted
+ * query lost track of goes away with the context.
+ */
+void gitAllocatorShutdown(void)
+{
+  if (git_libgit2_shutdown() != 0)
+    return;
+
+#ifdef HAVE_GIT_ALLOCATOR
+  if (libgit2_context != NULL)
+  {
+    pthread_mutex_lock(&deferred_lock);
+    deferred_frees = NULL;
+    pthread_mutex_unlock(&deferred_lock);
+
+    MemoryContextReset(libgit2_context);
+    pooled_bytes = 0;
+  }
+#endif
+}
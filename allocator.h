@@ -0,0 +1,12 @@
+/*
+ * libgit2 allocations routed through PostgreSQL.
+ *
+ * With libgit2 0.28+, everything libgit2 allocates on the backend's thread
+ * lives in the "git_fdw libgit2" memory context and counts against
+ * git_fdw.memory_limit. Refused allocations make libgit2 fail cleanly;
+ * gitAllocatorCheckLimit() then turns that into an error.
+ */
+void gitAllocatorInit(void);
+void gitAllocatorCheckLimit(void);
+int64 gitAllocatorUsage(void);
+void gitAllocatorShutdown(void);
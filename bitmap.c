@@ -0,0 +1,706 @@
+#include "postgres.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <git2.h>
+
+#include "miscadmin.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "bitmap.h"
+
+/*
+ * Pack bitmaps, as written by git (Documentation/technical/bitmap-format).
+ *
+ * A .bitmap belongs to one pack and numbers objects by their position in
+ * that pack, i.e. by increasing offset. Each bitmap is EWAH compressed and
+ * may be stored XORed with one of the entries before it. The commits it
+ * has entries for are identified by their position in the pack's .idx,
+ * which is sorted by sha1.
+ *
+ * Only v1 bitmaps over a single pack (not multi-pack-index bitmaps) and
+ * v2 .idx files are understood; anything else is reported as "no bitmap".
+ * Nothing in here throws on a malformed file, it gives up instead.
+ */
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+#define BITMAP_OPT_FULL_DAG 0x1
+#define BITMAP_HEADER_SIZE (4 + 2 + 2 + 4 + GIT_OID_RAWSZ)
+#define BITMAP_ENTRY_HEADER_SIZE (4 + 1 + 1)
+
+#define IDX_SIGNATURE "\377tOc"
+#define IDX_VERSION 2
+#define IDX_HEADER_SIZE (4 + 4 + 256 * 4)
+#define IDX_TRAILER_SIZE (2 * GIT_OID_RAWSZ)
+
+#define RIDX_SIGNATURE "RIDX"
+#define RIDX_HEADER_SIZE (4 + 4 + 4)
+
+#define EWAH_HEADER_SIZE (4 + 4)
+#define EWAH_TRAILER_SIZE 4
+
+/*
+ * Without a .rev file, the pack position of an object is the number of
+ * objects stored before it. A handful of those are cheaper to count than
+ * sorting the whole pack by offset, which we only do past this many.
+ */
+#define LINEAR_PACK_POSITION_LOOKUPS 16
+
+typedef struct GitFdwMappedFile
+{
+  const unsigned char *data;
+  size_t size;
+} GitFdwMappedFile;
+
+typedef struct GitFdwBitmapEntry
+{
+  uint32 commit_pos;          /* position of the commit in the .idx */
+  int xor_with;               /* entry it is XORed with, -1 if none */
+  const unsigned char *ewah;
+} GitFdwBitmapEntry;
+
+typedef struct GitFdwBitmapIndex
+{
+  git_repository *repo;
+  GitFdwMappedFile idx;
+  GitFdwMappedFile bitmap;
+  GitFdwMappedFile rev;       /* optional */
+
+  uint32 nobjects;
+  size_t nwords;              /* 64-bit words in a bitmap over the pack */
+  const unsigned char *sha1s;
+  const unsigned char *offsets;
+  const unsigned char *large_offsets;
+  size_t nlarge_offsets;
+
+  uint64 *commits;            /* which pack objects are commits */
+  GitFdwBitmapEntry *entries; /* in file order */
+  int nentries;
+  int *entries_by_commit;     /* entries sorted on commit_pos */
+
+  uint32 *pack_order;         /* .idx positions by offset, built on demand */
+  int linear_lookups;
+} GitFdwBitmapIndex;
+
+/* Everything reachable from a commit */
+typedef struct GitFdwReachable
+{
+  uint64 *bits;               /* pack objects */
+  HTAB *outside;              /* commits that are not in the pack */
+} GitFdwReachable;
+
+static uint32 gitBe32(const unsigned char *p)
+{
+  return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | (uint32)p[3];
+}
+
+static uint64 gitBe64(const unsigned char *p)
+{
+  return ((uint64)gitBe32(p) << 32) | (uint64)gitBe32(p + 4);
+}
+
+static uint64 gitPopcount(uint64 word)
+{
+#ifdef HAVE__BUILTIN_POPCOUNT
+  return (uint64)__builtin_popcountll(word);
+#else
+  uint64 count = 0;
+
+  while (word != 0)
+  {
+    word &= word - 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+static bool gitMapFile(const char *path, GitFdwMappedFile *file)
+{
+  struct stat st;
+  void *data;
+  int fd;
+
+  file->data = NULL;
+  file->size = 0;
+
+  fd = open(path, O_RDONLY | PG_BINARY, 0);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  file->data = (const unsigned char *)data;
+  file->size = st.st_size;
+  return true;
+}
+
+static void gitUnmapFile(GitFdwMappedFile *file)
+{
+  if (file->data != NULL)
+    munmap((void *)file->data, file->size);
+  file->data = NULL;
+  file->size = 0;
+}
+
+static void gitBitmapUnmap(void *arg)
+{
+  GitFdwBitmapIndex *index = (GitFdwBitmapIndex *)arg;
+
+  gitUnmapFile(&index->idx);
+  gitUnmapFile(&index->bitmap);
+  gitUnmapFile(&index->rev);
+}
+
+/* Size of the EWAH bitmap at ewah, 0 if it runs past end */
+static size_t gitEwahSize(const unsigned char *ewah, const unsigned char *end)
+{
+  size_t size;
+
+  if (end - ewah < EWAH_HEADER_SIZE)
+    return 0;
+
+  size = EWAH_HEADER_SIZE + (size_t)gitBe32(ewah + 4) * 8 + EWAH_TRAILER_SIZE;
+  return (size_t)(end - ewah) < size ? 0 : size;
+}
+
+/*
+ * Inflate (or XOR in) an EWAH bitmap. Each run-length word is followed by
+ * its literal words: bit 0 is the fill bit, the next 32 bits the number of
+ * filled words and the top 31 bits the number of literal words.
+ */
+static bool gitEwahDecode(const unsigned char *ewah, uint64 *bits, size_t nwords, bool xor)
+{
+  const unsigned char *words = ewah + EWAH_HEADER_SIZE;
+  size_t nwords_in = gitBe32(ewah + 4);
+  size_t in = 0;
+  size_t out = 0;
+
+  while (in < nwords_in)
+  {
+    uint64 rlw = gitBe64(words + 8 * in++);
+    uint64 fill = (rlw & 1) ? ~UINT64CONST(0) : 0;
+    size_t run = (size_t)((rlw >> 1) & UINT64CONST(0xFFFFFFFF));
+    size_t literals = (size_t)(rlw >> 33);
+
+    if (run > nwords - out || literals > nwords - out - run || literals > nwords_in - in)
+      return false;
+
+    for (; run > 0; run--, out++)
+      bits[out] = xor ? bits[out] ^ fill : fill;
+
+    for (; literals > 0; literals--, out++)
+    {
+      uint64 word = gitBe64(words + 8 * in++);
+
+      bits[out] = xor ? bits[out] ^ word : word;
+    }
+  }
+
+  if (!xor)
+    memset(bits + out, 0, (nwords - out) * sizeof(uint64));
+
+  return true;
+}
+
+static int gitCompareEntries(const void *a, const void *b, void *arg)
+{
+  GitFdwBitmapEntry *entries = (GitFdwBitmapEntry *)arg;
+  uint32 left = entries[*(const int *)a].commit_pos;
+  uint32 right = entries[*(const int *)b].commit_pos;
+
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static bool gitBitmapParse(GitFdwBitmapIndex *index)
+{
+  const unsigned char *data = index->bitmap.data;
+  const unsigned char *end = data + index->bitmap.size - GIT_OID_RAWSZ;
+  const unsigned char *p;
+  size_t size;
+  int i;
+
+  if (index->bitmap.size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ ||
+      memcmp(data, BITMAP_SIGNATURE, 4) != 0 ||
+      ((data[4] << 8) | data[5]) != BITMAP_VERSION ||
+      (((data[6] << 8) | data[7]) & BITMAP_OPT_FULL_DAG) == 0)
+    return false;
+
+  /* The bitmap must describe this very pack */
+  if (memcmp(data + 12, index->idx.data + index->idx.size - IDX_TRAILER_SIZE, GIT_OID_RAWSZ) != 0)
+    return false;
+
+  index->nentries = (int)gitBe32(data + 8);
+  if (index->nentries < 0)
+    return false;
+
+  p = data + BITMAP_HEADER_SIZE;
+
+  /* Type bitmaps: commits, trees, blobs and tags, only the first matters */
+  size = gitEwahSize(p, end);
+  if (size == 0 || !gitEwahDecode(p, index->commits, index->nwords, false))
+    return false;
+  p += size;
+
+  for (i = 0; i < 3; i++)
+  {
+    if ((size = gitEwahSize(p, end)) == 0)
+      return false;
+    p += size;
+  }
+
+  index->entries = (GitFdwBitmapEntry *)palloc(sizeof(GitFdwBitmapEntry) * Max(index->nentries, 1));
+  index->entries_by_commit = (int *)palloc(sizeof(int) * Max(index->nentries, 1));
+
+  for (i = 0; i < index->nentries; i++)
+  {
+    GitFdwBitmapEntry *entry = &index->entries[i];
+    int xor_offset;
+
+    if (end - p < BITMAP_ENTRY_HEADER_SIZE)
+      return false;
+
+    entry->commit_pos = gitBe32(p);
+    xor_offset = p[4];
+    p += BITMAP_ENTRY_HEADER_SIZE;
+
+    if (entry->commit_pos >= index->nobjects || xor_offset > i)
+      return false;
+
+    entry->xor_with = xor_offset ? i - xor_offset : -1;
+    entry->ewah = p;
+
+    if ((size = gitEwahSize(p, end)) == 0)
+      return false;
+    p += size;
+
+    index->entries_by_commit[i] = i;
+  }
+
+  qsort_arg(index->entries_by_commit, index->nentries, sizeof(int), gitCompareEntries, index->entries);
+  return true;
+}
+
+static bool gitIdxParse(GitFdwBitmapIndex *index)
+{
+  const unsigned char *data = index->idx.data;
+  size_t size = index->idx.size;
+  size_t tables;
+
+  if (size < IDX_HEADER_SIZE + IDX_TRAILER_SIZE ||
+      memcmp(data, IDX_SIGNATURE, 4) != 0 ||
+      gitBe32(data + 4) != IDX_VERSION)
+    return false;
+
+  /* The last fanout entry is the number of objects */
+  index->nobjects = gitBe32(data + IDX_HEADER_SIZE - 4);
+  tables = (size_t)index->nobjects * (GIT_OID_RAWSZ + 4 + 4);
+  if (size - IDX_HEADER_SIZE - IDX_TRAILER_SIZE < tables)
+    return false;
+
+  index->sha1s = data + IDX_HEADER_SIZE;
+  /* CRC32s come between the sha1s and the offsets */
+  index->offsets = index->sha1s + (size_t)index->nobjects * (GIT_OID_RAWSZ + 4);
+  index->large_offsets = index->offsets + (size_t)index->nobjects * 4;
+  index->nlarge_offsets = (size - IDX_HEADER_SIZE - IDX_TRAILER_SIZE - tables) / 8;
+  index->nwords = ((size_t)index->nobjects + 63) / 64;
+  return true;
+}
+
+static void gitBitmapClose(GitFdwBitmapIndex *index)
+{
+  gitBitmapUnmap(index);
+}
+
+/* Look for a pack with a bitmap in the repository's object store */
+static GitFdwBitmapIndex *gitBitmapOpen(git_repository *repo)
+{
+  GitFdwBitmapIndex *index;
+  char *pack_dir = psprintf("%sobjects/pack", git_repository_path(repo));
+  char *base = NULL;
+  DIR *dir;
+  struct dirent *de;
+
+  dir = opendir(pack_dir);
+  if (dir == NULL)
+    return NULL;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    size_t len = strlen(de->d_name);
+
+    if (len > 12 && strncmp(de->d_name, "pack-", 5) == 0 &&
+        strcmp(de->d_name + len - 7, ".bitmap") == 0)
+    {
+      base = psprintf("%s/%.*s", pack_dir, (int)(len - 7), de->d_name);
+      break;
+    }
+  }
+  closedir(dir);
+
+  if (base == NULL)
+    return NULL;
+
+  index = (GitFdwBitmapIndex *)palloc0(sizeof(GitFdwBitmapIndex));
+  index->repo = repo;
+
+#if (PG_VERSION_NUM >= 90500)
+  {
+    /* Don't leave the files mapped if we error out half way */
+    MemoryContextCallback *callback = (MemoryContextCallback *)palloc0(sizeof(MemoryContextCallback));
+
+    callback->func = gitBitmapUnmap;
+    callback->arg = index;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+  }
+#endif
+
+  if (!gitMapFile(psprintf("%s.idx", base), &index->idx) || !gitIdxParse(index) ||
+      !gitMapFile(psprintf("%s.bitmap", base), &index->bitmap))
+  {
+    gitBitmapClose(index);
+    return NULL;
+  }
+
+  index->commits = (uint64 *)palloc0(sizeof(uint64) * Max(index->nwords, 1));
+  if (!gitBitmapParse(index))
+  {
+    gitBitmapClose(index);
+    return NULL;
+  }
+
+  /* Written by git 2.31+ next to the pack, spares us sorting it */
+  if (gitMapFile(psprintf("%s.rev", base), &index->rev) &&
+      (index->rev.size < RIDX_HEADER_SIZE + (size_t)index->nobjects * 4 ||
+       memcmp(index->rev.data, RIDX_SIGNATURE, 4) != 0 ||
+       gitBe32(index->rev.data + 4) != 1))
+    gitUnmapFile(&index->rev);
+
+  return index;
+}
+
+static bool gitIdxFind(GitFdwBitmapIndex *index, const git_oid *oid, uint32 *pos)
+{
+  const unsigned char *fanout = index->idx.data + 8;
+  uint32 lo = oid->id[0] == 0 ? 0 : gitBe32(fanout + 4 * (oid->id[0] - 1));
+  uint32 hi = gitBe32(fanout + 4 * oid->id[0]);
+
+  if (hi > index->nobjects)
+    return false;
+
+  while (lo < hi)
+  {
+    uint32 mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(index->sha1s + (size_t)mid * GIT_OID_RAWSZ, oid->id, GIT_OID_RAWSZ);
+
+    if (cmp == 0)
+    {
+      *pos = mid;
+      return true;
+    }
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return false;
+}
+
+static uint64 gitIdxOffset(GitFdwBitmapIndex *index, uint32 pos)
+{
+  uint32 offset = gitBe32(index->offsets + (size_t)pos * 4);
+
+  if ((offset & 0x80000000) == 0)
+    return offset;
+
+  offset &= 0x7fffffff;
+  return offset < index->nlarge_offsets ? gitBe64(index->large_offsets + (size_t)offset * 8) : 0;
+}
+
+static int gitCompareOffsets(const void *a, const void *b, void *arg)
+{
+  GitFdwBitmapIndex *index = (GitFdwBitmapIndex *)arg;
+  uint64 left = gitIdxOffset(index, *(const uint32 *)a);
+  uint64 right = gitIdxOffset(index, *(const uint32 *)b);
+
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+/* .idx position of the pack_pos-th object of the pack */
+static uint32 gitPackOrder(GitFdwBitmapIndex *index, uint32 pack_pos)
+{
+  if (index->rev.data != NULL)
+    return gitBe32(index->rev.data + RIDX_HEADER_SIZE + (size_t)pack_pos * 4);
+  return index->pack_order[pack_pos];
+}
+
+/* Bit number of an object in the pack's bitmaps */
+static uint32 gitPackPosition(GitFdwBitmapIndex *index, uint32 idx_pos)
+{
+  uint64 offset = gitIdxOffset(index, idx_pos);
+  uint32 lo = 0, hi = index->nobjects;
+
+  if (index->rev.data == NULL && index->pack_order == NULL)
+  {
+    if (index->linear_lookups++ < LINEAR_PACK_POSITION_LOOKUPS)
+    {
+      uint32 before = 0, pos;
+
+      for (pos = 0; pos < index->nobjects; pos++)
+      {
+        if (gitIdxOffset(index, pos) < offset)
+          before++;
+      }
+      return before;
+    }
+
+    index->pack_order = (uint32 *)MemoryContextAllocHuge(CurrentMemoryContext,
+                                                         sizeof(uint32) * Max(index->nobjects, 1));
+    for (lo = 0; lo < index->nobjects; lo++)
+      index->pack_order[lo] = lo;
+    qsort_arg(index->pack_order, index->nobjects, sizeof(uint32), gitCompareOffsets, index);
+    lo = 0;
+  }
+
+  while (lo < hi)
+  {
+    uint32 mid = lo + (hi - lo) / 2;
+
+    if (gitIdxOffset(index, gitPackOrder(index, mid)) < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static int gitBitmapFindEntry(GitFdwBitmapIndex *index, uint32 commit_pos)
+{
+  int lo = 0, hi = index->nentries;
+
+  while (lo < hi)
+  {
+    int mid = lo + (hi - lo) / 2;
+    uint32 pos = index->entries[index->entries_by_commit[mid]].commit_pos;
+
+    if (pos == commit_pos)
+      return index->entries_by_commit[mid];
+    if (pos < commit_pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return -1;
+}
+
+/*
+ * Rebuild an entry's bitmap. A stored entry is its bitmap XOR its base's,
+ * so the result is the XOR of the whole chain down to an entry without a
+ * base.
+ */
+static bool gitBitmapEntryBits(GitFdwBitmapIndex *index, int entry, uint64 *bits)
+{
+  bool ok;
+
+  /* Bases always come before the entries using them */
+  ok = gitEwahDecode(index->entries[entry].ewah, bits, index->nwords, false);
+  for (entry = index->entries[entry].xor_with; ok && entry >= 0; entry = index->entries[entry].xor_with)
+    ok = gitEwahDecode(index->entries[entry].ewah, bits, index->nwords, true);
+
+  return ok;
+}
+
+static bool gitBitIsSet(const uint64 *bits, uint32 bit)
+{
+  return (bits[bit / 64] & (UINT64CONST(1) << (bit % 64))) != 0;
+}
+
+/*
+ * Everything reachable from tip. Commits are walked until they are
+ * covered by a bitmap entry (or by what's been collected already), which
+ * for a freshly repacked repository means right away. Commits outside of
+ * the pack can only sit on top of it, the bitmap has the full DAG.
+ */
+static bool gitBitmapReach(GitFdwBitmapIndex *index, const git_oid *tip, GitFdwReachable *reach)
+{
+  uint64 *entry_bits = (uint64 *)palloc(sizeof(uint64) * Max(index->nwords, 1));
+  int capacity = 64;
+  int depth = 0;
+  git_oid *stack = (git_oid *)palloc(sizeof(git_oid) * capacity);
+  HASHCTL outside;
+  bool ok = true;
+
+  memset(&outside, 0, sizeof(outside));
+  outside.keysize = sizeof(git_oid);
+  outside.entrysize = sizeof(git_oid);
+  outside.hcxt = CurrentMemoryContext;
+#if (PG_VERSION_NUM >= 90500)
+  reach->outside = hash_create("git_fdw unpacked commits", 64, &outside,
+                               HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+#else
+  outside.hash = tag_hash;
+  reach->outside = hash_create("git_fdw unpacked commits", 64, &outside,
+                               HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+#endif
+  reach->bits = (uint64 *)palloc0(sizeof(uint64) * Max(index->nwords, 1));
+
+  stack[depth++] = *tip;
+
+  while (ok && depth > 0)
+  {
+    git_oid oid = stack[--depth];
+    git_commit *commit;
+    uint32 idx_pos;
+    unsigned int parent;
+
+    CHECK_FOR_INTERRUPTS();
+
+    if (gitIdxFind(index, &oid, &idx_pos))
+    {
+      int entry = gitBitmapFindEntry(index, idx_pos);
+      uint32 pack_pos;
+      size_t word;
+
+      if (entry >= 0)
+      {
+        ok = gitBitmapEntryBits(index, entry, entry_bits);
+        for (word = 0; ok && word < index->nwords; word++)
+          reach->bits[word] |= entry_bits[word];
+        continue;
+      }
+
+      pack_pos = gitPackPosition(index, idx_pos);
+      if (gitBitIsSet(reach->bits, pack_pos))
+        continue;
+      reach->bits[pack_pos / 64] |= UINT64CONST(1) << (pack_pos % 64);
+    }
+    else
+    {
+      bool found;
+
+      hash_search(reach->outside, &oid, HASH_ENTER, &found);
+      if (found)
+        continue;
+    }
+
+    if (git_commit_lookup(&commit, index->repo, &oid) != GIT_OK)
+    {
+      ok = false;
+      break;
+    }
+
+    for (parent = 0; parent < git_commit_parentcount(commit); parent++)
+    {
+      if (depth == capacity)
+      {
+        capacity *= 2;
+        stack = (git_oid *)repalloc(stack, sizeof(git_oid) * capacity);
+      }
+      stack[depth++] = *git_commit_parent_id(commit, parent);
+    }
+    git_commit_free(commit);
+  }
+
+  pfree(stack);
+  pfree(entry_bits);
+  return ok;
+}
+
+/*
+ * Number of commits reachable from include and, when given, not from
+ * exclude.
+ */
+bool gitBitmapCountCommits(git_repository *repo,
+                           const git_oid *include,
+                           const git_oid *exclude,
+                           double *count)
+{
+  GitFdwBitmapIndex *index = gitBitmapOpen(repo);
+  GitFdwReachable included, excluded;
+  bool ok;
+
+  if (index == NULL)
+    return false;
+
+  ok = gitBitmapReach(index, include, &included) &&
+       (exclude == NULL || gitBitmapReach(index, exclude, &excluded));
+
+  if (ok)
+  {
+    uint64 total = 0;
+    size_t word;
+
+    for (word = 0; word < index->nwords; word++)
+    {
+      uint64 commits = included.bits[word] & index->commits[word];
+
+      if (exclude != NULL)
+        commits &= ~excluded.bits[word];
+      total += gitPopcount(commits);
+    }
+
+    if (exclude == NULL)
+      total += hash_get_num_entries(included.outside);
+    else
+    {
+      HASH_SEQ_STATUS status;
+      git_oid *oid;
+
+      hash_seq_init(&status, included.outside);
+      while ((oid = (git_oid *)hash_seq_search(&status)) != NULL)
+      {
+        if (hash_search(excluded.outside, oid, HASH_FIND, NULL) == NULL)
+          total++;
+      }
+    }
+
+    *count = (double)total;
+  }
+
+  gitBitmapClose(index);
+  return ok;
+}
+
+/* Is oid reachable from tip? */
+bool gitBitmapIsReachable(git_repository *repo,
+                          const git_oid *tip,
+                          const git_oid *oid,
+                          bool *reachable)
+{
+  GitFdwBitmapIndex *index = gitBitmapOpen(repo);
+  GitFdwReachable reach;
+  uint32 idx_pos;
+  bool ok;
+
+  if (index == NULL)
+    return false;
+
+  ok = gitBitmapReach(index, tip, &reach);
+  if (ok)
+  {
+    if (gitIdxFind(index, oid, &idx_pos))
+      *reachable = gitBitIsSet(reach.bits, gitPackPosition(index, idx_pos));
+    else
+      *reachable = hash_search(reach.outside, oid, HASH_FIND, NULL) != NULL;
+  }
+
+  gitBitmapClose(index);
+  return ok;
+}
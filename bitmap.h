@@ -0,0 +1,16 @@
+/*
+ * Reachability answered from pack bitmaps.
+ *
+ * `git repack -b` (and most git hosting) leaves a .bitmap next to the pack,
+ * holding for a selection of commits the set of objects they reach. Each
+ * entry point returns false when the repository has no usable bitmap and
+ * the caller has to walk the history instead.
+ */
+bool gitBitmapCountCommits(git_repository *repo,
+                           const git_oid *include,
+                           const git_oid *exclude,
+                           double *count);
+bool gitBitmapIsReachable(git_repository *repo,
+                          const git_oid *tip,
+                          const git_oid *oid,
+                          bool *reachable);
@@ -0,0 +1,474 @@
+#include "postgres.h"
+
+#include <git2.h>
+
+#include "miscadmin.h"
+#include "access/hash.h"
+#include "lib/ilist.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "allocator.h"
+#include "blame.h"
+
+#if LIBGIT2_VER_MAJOR >= 1 || LIBGIT2_VER_MINOR >= 28
+#define HAVE_GIT_BLAME_MAILMAP
+#endif
+
+/* In kB, 0 to not cache anything */
+static int git_fdw_blame_cache_size = 16384;
+
+typedef struct GitFdwBlameKey
+{
+  git_oid blob;
+  git_oid oldest; /* zero when the whole history is looked at */
+  bool mailmap;
+  const char *repository;
+  const char *path;
+} GitFdwBlameKey;
+
+/* The commit a run of consecutive lines comes from */
+typedef struct GitFdwBlameHunk
+{
+  git_oid commit;
+  char *author_name;
+  char *author_email;
+  git_time_t commit_time;
+} GitFdwBlameHunk;
+
+typedef struct GitFdwBlameLineInfo
+{
+  char *content; /* into the blob's copy */
+  int length;
+  int hunk; /* -1 when libgit2 didn't say */
+} GitFdwBlameLineInfo;
+
+struct GitFdwBlame
+{
+  GitFdwBlameKey key;
+  MemoryContext context; /* everything below, the GitFdwBlame included */
+  Size bytes;
+  int pins;         /* scans returning its lines */
+  bool in_cache;
+  dlist_node lru;   /* most recently used first */
+
+  GitFdwBlameLineInfo *lines;
+  int nlines;
+  GitFdwBlameHunk *hunks;
+  int nhunks;
+};
+
+typedef struct GitFdwBlameEntry
+{
+  GitFdwBlameKey key; /* hash key, must be first */
+  GitFdwBlame *blame;
+} GitFdwBlameEntry;
+
+static MemoryContext blame_cache_context = NULL;
+static HTAB *blame_cache = NULL;
+static dlist_head blame_lru = DLIST_STATIC_INIT(blame_lru);
+static Size blame_cache_bytes = 0;
+
+static uint32 gitBlameKeyHash(const void *key, Size keysize);
+static int gitBlameKeyMatch(const void *key1, const void *key2, Size keysize);
+static GitFdwBlame *gitBlameBuild(git_repository *repo, const GitFdwBlameKey *key, const git_oid *commit);
+static void gitBlameStore(GitFdwBlame *blame);
+static void gitBlameEvict(Size limit);
+
+void gitBlameInit(void)
+{
+  DefineCustomIntVariable("git_fdw.blame_cache_size",
+                          "Sets the memory used to remember blamed files in a backend.",
+                          "0 disables the cache.",
+                          &git_fdw_blame_cache_size,
+                          16384,
+                          0,
+                          INT_MAX,
+                          PGC_USERSET,
+                          GUC_UNIT_KB,
+                          NULL,
+                          NULL,
+                          NULL);
+}
+
+/*
+ * The lines of path as of commit, with the commit each comes from. Returns
+ * NULL when commit has no such file. The result stays valid until released.
+ */
+GitFdwBlame *gitBlameFile(git_repository *repo,
+                          const char *repository,
+                          const git_oid *commit_oid,
+                          const char *path,
+                          const git_oid *oldest,
+                          bool mailmap,
+                          bool *cached)
+{
+  git_commit *commit;
+  git_tree *tree;
+  git_tree_entry *entry;
+  GitFdwBlameKey key;
+  GitFdwBlameEntry *cache_entry = NULL;
+  GitFdwBlame *blame;
+  git_filemode_t mode;
+
+  *cached = false;
+
+  if (git_commit_lookup(&commit, repo, commit_oid) != GIT_OK)
+  {
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed to lookup commit %s", git_oid_tostr_s(commit_oid))));
+  }
+
+  if (git_commit_tree(&tree, commit) != GIT_OK)
+  {
+    git_commit_free(commit);
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed to lookup the tree of commit %s", git_oid_tostr_s(commit_oid))));
+  }
+  git_commit_free(commit);
+
+  if (git_tree_entry_bypath(&entry, tree, path) != GIT_OK)
+  {
+    git_tree_free(tree);
+    gitAllocatorCheckLimit();
+    return NULL;
+  }
+  git_tree_free(tree);
+
+  memset(&key, 0, sizeof(key));
+  key.blob = *git_tree_entry_id(entry);
+  mode = git_tree_entry_filemode(entry);
+  git_tree_entry_free(entry);
+
+  /* Directories, symbolic links and submodules have no lines */
+  if (mode != GIT_FILEMODE_BLOB && mode != GIT_FILEMODE_BLOB_EXECUTABLE)
+    return NULL;
+
+  if (oldest != NULL)
+    key.oldest = *oldest;
+  key.mailmap = mailmap;
+  key.repository = repository;
+  key.path = path;
+
+  if (blame_cache != NULL)
+    cache_entry = (GitFdwBlameEntry *)hash_search(blame_cache, &key, HASH_FIND, NULL);
+
+  if (cache_entry != NULL)
+  {
+    blame = cache_entry->blame;
+    dlist_move_head(&blame_lru, &blame->lru);
+    *cached = true;
+  }
+  else
+  {
+    blame = gitBlameBuild(repo, &key, commit_oid);
+    gitBlameStore(blame);
+  }
+
+  blame->pins++;
+  return blame;
+}
+
+int gitBlameLineCount(GitFdwBlame *blame)
+{
+  return blame->nlines;
+}
+
+/* line_no counts from 1 */
+void gitBlameGetLine(GitFdwBlame *blame, int line_no, GitFdwBlameLine *line)
+{
+  GitFdwBlameLineInfo *info = &blame->lines[line_no - 1];
+
+  line->content = info->content;
+  line->length = info->length;
+  if (info->hunk < 0)
+  {
+    line->commit = NULL;
+    line->author_name = NULL;
+    line->author_email = NULL;
+    line->commit_time = 0;
+  }
+  else
+  {
+    GitFdwBlameHunk *hunk = &blame->hunks[info->hunk];
+
+    line->commit = &hunk->commit;
+    line->author_name = hunk->author_name;
+    line->author_email = hunk->author_email;
+    line->commit_time = hunk->commit_time;
+  }
+}
+
+void gitBlameRelease(GitFdwBlame *blame)
+{
+  blame->pins--;
+  if (blame->pins > 0)
+    return;
+
+  if (!blame->in_cache)
+    MemoryContextDelete(blame->context);
+  else
+    gitBlameEvict((Size)git_fdw_blame_cache_size * 1024);
+}
+
+/*
+ * Runs libgit2's blame and copies what the rows need. Until it gets stored,
+ * the result lives under the caller's memory context and goes away with it
+ * on error.
+ */
+static GitFdwBlame *gitBlameBuild(git_repository *repo, const GitFdwBlameKey *key, const git_oid *commit_oid)
+{
+  MemoryContext context;
+  MemoryContext old_context;
+  GitFdwBlame *blame;
+  git_blob *volatile blob = NULL;
+  git_blame *volatile result = NULL;
+
+  context = AllocSetContextCreate(CurrentMemoryContext,
+                                  "git_fdw blame",
+                                  ALLOCSET_SMALL_MINSIZE,
+                                  ALLOCSET_SMALL_INITSIZE,
+                                  ALLOCSET_DEFAULT_MAXSIZE);
+  old_context = MemoryContextSwitchTo(context);
+
+  blame = (GitFdwBlame *)palloc0(sizeof(GitFdwBlame));
+  blame->context = context;
+  blame->key = *key;
+  blame->key.repository = pstrdup(key->repository);
+  blame->key.path = pstrdup(key->path);
+  blame->bytes = sizeof(GitFdwBlame) + strlen(key->repository) + strlen(key->path) + 2;
+
+  PG_TRY();
+  {
+    git_blame_options options = GIT_BLAME_OPTIONS_INIT;
+    const char *content;
+    char *text;
+    size_t size;
+    size_t offset;
+    int line;
+    uint32_t i;
+
+    if (git_blob_lookup((git_blob **)&blob, repo, &key->blob) != GIT_OK)
+    {
+      gitAllocatorCheckLimit();
+      ereport(ERROR,
+              (errcode(ERRCODE_FDW_ERROR),
+               errmsg("Failed to lookup blob %s", git_oid_tostr_s(&key->blob))));
+    }
+
+    options.newest_commit = *commit_oid;
+    options.oldest_commit = key->oldest;
+#ifdef HAVE_GIT_BLAME_MAILMAP
+    if (key->mailmap)
+      options.flags |= GIT_BLAME_USE_MAILMAP;
+#endif
+
+    if (git_blame_file((git_blame **)&result, repo, key->path, &options) != GIT_OK)
+    {
+      const git_error *err = giterr_last();
+      char *message = pstrdup(err != NULL ? err->message : "unknown error");
+
+      gitAllocatorCheckLimit();
+      ereport(ERROR,
+              (errcode(ERRCODE_FDW_ERROR),
+               errmsg("Failed to blame %s", key->path),
+               errdetail("libgit2 said: %s.", message)));
+    }
+    gitAllocatorCheckLimit();
+
+    /* Lines are the blob's, split on newlines, the last one may lack its own */
+    content = (const char *)git_blob_rawcontent(blob);
+    size = (size_t)git_blob_rawsize(blob);
+    for (offset = 0; offset < size; offset++)
+    {
+      if (content[offset] == '\n')
+        blame->nlines++;
+    }
+    if (size > 0 && content[size - 1] != '\n')
+      blame->nlines++;
+
+    blame->lines = (GitFdwBlameLineInfo *)palloc(sizeof(GitFdwBlameLineInfo) * Max(blame->nlines, 1));
+    blame->bytes += sizeof(GitFdwBlameLineInfo) * blame->nlines;
+
+    /* One copy of the blob, with each newline turned into a terminator */
+    text = (char *)palloc(size + 1);
+    memcpy(text, content, size);
+    text[size] = '\0';
+    blame->bytes += size + 1;
+
+    line = 0;
+    offset = 0;
+    while (offset < size)
+    {
+      char *start = text + offset;
+      char *end = memchr(start, '\n', size - offset);
+      int length = end != NULL ? (int)(end - start) : (int)(size - offset);
+
+      start[length] = '\0';
+      blame->lines[line].content = start;
+      blame->lines[line].length = length;
+      blame->lines[line].hunk = -1;
+
+      line++;
+      offset += length + 1;
+    }
+
+    blame->nhunks = git_blame_get_hunk_count(result);
+    blame->hunks = (GitFdwBlameHunk *)palloc0(sizeof(GitFdwBlameHunk) * Max(blame->nhunks, 1));
+    blame->bytes += sizeof(GitFdwBlameHunk) * blame->nhunks;
+
+    for (i = 0; i < (uint32_t)blame->nhunks; i++)
+    {
+      const git_blame_hunk *hunk = git_blame_get_hunk_byindex(result, i);
+      GitFdwBlameHunk *copy = &blame->hunks[i];
+      git_commit *commit;
+      size_t line_no;
+
+      CHECK_FOR_INTERRUPTS();
+
+      copy->commit = hunk->final_commit_id;
+      if (hunk->final_signature != NULL)
+      {
+        copy->author_name = pstrdup(hunk->final_signature->name);
+        copy->author_email = pstrdup(hunk->final_signature->email);
+        copy->commit_time = hunk->final_signature->when.time;
+        blame->bytes += strlen(copy->author_name) + strlen(copy->author_email) + 2;
+      }
+
+      /* The signature is the author's, rows show when it got committed */
+      if (git_commit_lookup(&commit, repo, &hunk->final_commit_id) == GIT_OK)
+      {
+        copy->commit_time = git_commit_time(commit);
+        git_commit_free(commit);
+      }
+
+      for (line_no = hunk->final_start_line_number;
+           line_no < hunk->final_start_line_number + hunk->lines_in_hunk;
+           line_no++)
+      {
+        if (line_no >= 1 && line_no <= (size_t)blame->nlines)
+          blame->lines[line_no - 1].hunk = (int)i;
+      }
+    }
+
+    gitAllocatorCheckLimit();
+  }
+  PG_CATCH();
+  {
+    git_blame_free(result);
+    git_blob_free(blob);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  git_blame_free(result);
+  git_blob_free(blob);
+
+  MemoryContextSwitchTo(old_context);
+  return blame;
+}
+
+/*
+ * Moves a freshly built blame under the cache's context, and into the cache
+ * itself if it fits. Either way, scans only release it once done with it.
+ */
+static void gitBlameStore(GitFdwBlame *blame)
+{
+  Size limit = (Size)git_fdw_blame_cache_size * 1024;
+  GitFdwBlameEntry *entry;
+  bool found;
+
+  if (blame_cache == NULL)
+  {
+    HASHCTL ctl;
+
+    blame_cache_context = AllocSetContextCreate(TopMemoryContext,
+                                                "git_fdw blame cache",
+                                                ALLOCSET_DEFAULT_MINSIZE,
+                                                ALLOCSET_DEFAULT_INITSIZE,
+                                                ALLOCSET_DEFAULT_MAXSIZE);
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(GitFdwBlameKey);
+    ctl.entrysize = sizeof(GitFdwBlameEntry);
+    ctl.hash = gitBlameKeyHash;
+    ctl.match = gitBlameKeyMatch;
+    ctl.hcxt = blame_cache_context;
+    blame_cache = hash_create("git_fdw blame cache",
+                              256,
+                              &ctl,
+                              HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+  }
+
+  MemoryContextSetParent(blame->context, blame_cache_context);
+
+  if (blame->bytes > limit)
+    return;
+
+  gitBlameEvict(limit - blame->bytes);
+
+  /* The key points into the blame, which is removed along with the entry */
+  entry = (GitFdwBlameEntry *)hash_search(blame_cache, &blame->key, HASH_ENTER, &found);
+  entry->blame = blame;
+  blame->in_cache = true;
+  dlist_push_head(&blame_lru, &blame->lru);
+  blame_cache_bytes += blame->bytes;
+}
+
+/* Forgets the least recently used blames nobody returns rows from */
+static void gitBlameEvict(Size limit)
+{
+  dlist_node *node;
+
+  if (blame_cache_bytes <= limit || dlist_is_empty(&blame_lru))
+    return;
+
+  node = dlist_tail_node(&blame_lru);
+  while (node != NULL && blame_cache_bytes > limit)
+  {
+    GitFdwBlame *blame = dlist_container(GitFdwBlame, lru, node);
+
+    /* The node goes away with the blame */
+    node = dlist_has_prev(&blame_lru, node) ? dlist_prev_node(&blame_lru, node) : NULL;
+    if (blame->pins > 0)
+      continue;
+
+    dlist_delete(&blame->lru);
+    hash_search(blame_cache, &blame->key, HASH_REMOVE, NULL);
+    blame_cache_bytes -= blame->bytes;
+    MemoryContextDelete(blame->context);
+  }
+}
+
+static uint32 gitBlameKeyHash(const void *key, Size keysize)
+{
+  const GitFdwBlameKey *blame_key = (const GitFdwBlameKey *)key;
+  uint32 hash;
+
+  hash = DatumGetUInt32(hash_any((const unsigned char *)&blame_key->blob, sizeof(git_oid)));
+  hash ^= DatumGetUInt32(hash_any((const unsigned char *)blame_key->path, strlen(blame_key->path)));
+  hash = ((hash << 1) | (hash >> 31)) ^ DatumGetUInt32(hash_any((const unsigned char *)&blame_key->oldest,
+                                                                sizeof(git_oid)));
+  return hash;
+}
+
+static int gitBlameKeyMatch(const void *key1, const void *key2, Size keysize)
+{
+  const GitFdwBlameKey *left = (const GitFdwBlameKey *)key1;
+  const GitFdwBlameKey *right = (const GitFdwBlameKey *)key2;
+
+  if (git_oid_cmp(&left->blob, &right->blob) != 0 ||
+      git_oid_cmp(&left->oldest, &right->oldest) != 0 ||
+      left->mailmap != right->mailmap)
+    return 1;
+
+  if (strcmp(left->path, right->path) != 0 ||
+      strcmp(left->repository, right->repository) != 0)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Line by line history of a file, like `git blame`.
+ *
+ * Results are kept per backend, keyed on the file's blob, its path and the
+ * history window, up to git_fdw.blame_cache_size. Blaming a file again at a
+ * commit where it didn't change only costs a tree lookup.
+ */
+typedef struct GitFdwBlame GitFdwBlame;
+
+/* A line of a blamed file */
+typedef struct GitFdwBlameLine
+{
+  const char *content;
+  int length;
+  const git_oid *commit; /* that last changed it, NULL if unknown */
+  const char *author_name;
+  const char *author_email;
+  git_time_t commit_time;
+} GitFdwBlameLine;
+
+void gitBlameInit(void);
+GitFdwBlame *gitBlameFile(git_repository *repo,
+                          const char *repository,
+                          const git_oid *commit,
+                          const char *path,
+                          const git_oid *oldest,
+                          bool mailmap,
+                          bool *cached);
+int gitBlameLineCount(GitFdwBlame *blame);
+void gitBlameGetLine(GitFdwBlame *blame, int line_no, GitFdwBlameLine *line);
+void gitBlameRelease(GitFdwBlame *blame);
@@ -1,3 +1,147 @@
+#if LIBGIT2_VER_MAJOR >= 1 || LIBGIT2_VER_MINOR >= 28
+#define HAVE_GIT_MAILMAP
+#define GIT_FDW_OBJECT_COMMIT GIT_OBJECT_COMMIT
+#else
+#define GIT_FDW_OBJECT_COMMIT GIT_OBJ_COMMIT
+#endif
+
+/* What a foreign table attribute holds, resolved from its name */
+typedef enum GitFdwColumn
+{
+	GIT_COLUMN_UNKNOWN,
+	GIT_COLUMN_SHA1,
+	GIT_COLUMN_MESSAGE,
+	GIT_COLUMN_NAME,
+	GIT_COLUMN_EMAIL,
+	GIT_COLUMN_COMMIT_DATE,
+	GIT_COLUMN_AUTHOR_NAME,
+	GIT_COLUMN_AUTHOR_EMAIL,
+	GIT_COLUMN_AUTHOR_DATE,
+	GIT_COLUMN_INSERTIONS,
+	GIT_COLUMN_DELETIONS,
+	GIT_COLUMN_FILES_CHANGED,
+	/* grep tables */
+	GIT_COLUMN_PATTERN,
+	GIT_COLUMN_PATH,
+	GIT_COLUMN_LINE_NO,
+	GIT_COLUMN_LINE,
+	/* blame tables */
+	GIT_COLUMN_COMMIT_SHA1
+} GitFdwColumn;
+
+#define IDENTITY_KEY_LENGTH 256
+
+/* A (mailmap-resolved) identity, shared by every row it appears in */
+typedef struct GitFdwIdentity
+{
+	char		key[IDENTITY_KEY_LENGTH];	/* "name <email>" as found in the commit */
+	Datum		name;
+	Datum		email;
+} GitFdwIdentity;
+
+/* Aggregates the scan knows how to compute */
+typedef enum GitFdwAggKind
+{
+	GIT_AGG_UNSUPPORTED,
+	GIT_AGG_COUNT_STAR,
+	GIT_AGG_COUNT,
+	GIT_AGG_SUM,
+	GIT_AGG_MIN,
+	GIT_AGG_MAX
+} GitFdwAggKind;
+
+#define GIT_FDW_MAX_GROUP_KEYS 8
+
+struct GitFdwAggregation;
+struct GitFdwGrep;
+struct GitFdwBlame;
+struct GitFdwPrefetch;
+
+typedef struct GitFdwGroupKey
+{
+	/* Tells the hash functions which values are by reference */
+	const struct GitFdwAggregation *aggregation;
+	Datum		values[GIT_FDW_MAX_GROUP_KEYS];
+	bool		isnull[GIT_FDW_MAX_GROUP_KEYS];
+} GitFdwGroupKey;
+
+typedef struct GitFdwAggValue
+{
+	int64		count;			/* non-null inputs */
+	int64		sum;
+	int64		extreme;		/* min or max so far */
+} GitFdwAggValue;
+
+typedef struct GitFdwGroup
+{
+	GitFdwGroupKey key;
+	GitFdwAggValue values[FLEXIBLE_ARRAY_MEMBER];
+} GitFdwGroup;
+
+typedef struct GitFdwAggregation
+{
+	/* Restriction clauses and input rows they're evaluated on */
+	ExprState  *quals;
+	TupleTableSlot *row;
+
+	int			nkeys;
+	ExprState  *keys[GIT_FDW_MAX_GROUP_KEYS];
+	bool		key_byval[GIT_FDW_MAX_GROUP_KEYS];
+	int16		key_typlen[GIT_FDW_MAX_GROUP_KEYS];
+
+	int			naggs;
+	GitFdwAggKind *kinds;
+	ExprState **args;
+	Oid		   *argtypes;
+
+	/* Output column => key index, or -(aggregate index + 1) */
+	int		   *outputs;
+	int			noutputs;
+
+	HTAB	   *groups;
+	HASH_SEQ_STATUS iterator;
+	bool		accumulated;
+	bool		iterating;
+} GitFdwAggregation;
+
+/* A commit as a commits table row needs it, decoded as far as the scan fetches */
+typedef struct GitFdwCommitRow
+{
+	git_oid		oid;
+	const char *message;		/* NULL below GIT_FETCH_COMMIT */
+	const char *committer_name;
+	const char *committer_email;
+	git_time_t	commit_time;
+	const char *author_name;
+	const char *author_email;
+	git_time_t	author_time;
+	int64		insertions;		/* 0 below GIT_FETCH_DIFF */
+	int64		deletions;
+	int64		files_changed;
+} GitFdwCommitRow;
+
+typedef struct GitFdwScanInstrumentation
+{
+	/* What the scan did */
+	int64		commits_walked;
+	int64		commits_filtered;
+	int64		commits_emitted;
+	int64		objects_looked_up;
+	int64		trees_diffed;
+	int64		commit_bytes;
+	int64		identity_hits;
+	int64		identity_misses;
+	int64		blame_cache_hits;
+	int64		blame_cache_misses;
+
+	/* Where the time went, only tracked under EXPLAIN ANALYZE */
+	instr_time	ref_resolution;
+	instr_time	revwalk;
+	instr_time	commit_decode;
+	instr_time	diff;
+	instr_time	tuple_formation;
+} GitFdwScanInstrumentation;
+
 typedef struct GitFdwExecutionState
 {
 	char	   *path;
@@ -7,4 +151,63 @@ typedef struct GitFdwExecutionState
 	git_repository *repo;
 	int passes;
 	git_revwalk *walker;
+	git_oid		tip;
+	git_odb    *odb;
+	git_commit *commit;			/* the current row's, freed with the next one */
+	bool		libgit2_initialized;	/* until the handles are released */
+	MemoryContext scan_context;
+	MemoryContext row_context;
+
+	/* Attribute number - 1 => what goes in it */
+	GitFdwColumn *columns;
+	int			ncolumns;
+
+	/* Identities seen so far, keyed on "name <email>" */
+	HTAB	   *identities;
+#ifdef HAVE_GIT_MAILMAP
+	git_mailmap *mailmap;
+#endif
+
+	/* Pushed-down filters, checked on the raw commit */
+	List	   *author_emails;
+	List	   *message_literals;	/* substrings of the message */
+	List	   *message_literals_ci;	/* same, lowercase, in any case */
+
+	/* `sha1 = 'constant'`: the one commit to return, if the branch reaches it */
+	char	   *sha1;
+	git_oid		point;
+	bool		point_pending;
+
+	/* What the plan needs from each commit */
+	GitFdwFetch fetch;
+
+	/* What the table returns, from its kind option */
+	GitFdwTableKind kind;
+
+	/* Grep tables: the pushed-down search, run from the first row on */
+	char	   *pattern;
+	char	   *path_prefix;
+	struct GitFdwGrep *grep;
+	bool		grep_started;
+
+	/* Blame tables: the pushed-down file, blamed on the first row */
+	char	   *file_path;
+	git_oid		oldest;
+	bool		has_oldest;
+	struct GitFdwBlame *blame;
+	bool		blame_started;
+	int			blame_line;		/* last returned, from 1 */
+
+	/* Asynchronous scans: the branch is walked by a thread of its own */
+	bool		async;
+	struct GitFdwPrefetch *prefetch;
+	bool		prefetch_done;	/* the thread walked it all, and it was all returned */
+	bool		in_async_request;	/* Iterate mustn't wait, the Append does */
+
+	/* Set when the scan computes an aggregation instead of returning commits */
+	Oid			relid;
+	GitFdwAggregation *aggregation;
+
+	bool		timing;
+	GitFdwScanInstrumentation instrumentation;
 } GitFdwExecutionState;
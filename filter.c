@@ -0,0 +1,319 @@
+#include "postgres.h"
+
+#include <ctype.h>
+#include <git2.h>
+
+#include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "nodes/pg_list.h"
+#include "nodes/value.h"
+#include "grep.h"
+#include "filter.h"
+
+static void gitKeepLongest(StringInfo run, StringInfo best);
+static const char *gitSkipGroup(const char *p);
+static const char *gitSkipBracket(const char *p);
+
+/*
+ * The runs of literal characters of a LIKE pattern (with the default escape),
+ * all of which a matching string contains.
+ */
+List *gitLikeLiterals(const char *pattern)
+{
+  List *literals = NIL;
+  StringInfoData run;
+  const char *p;
+
+  initStringInfo(&run);
+  for (p = pattern;; p++)
+  {
+    if (*p == '\0' || *p == '%' || *p == '_')
+    {
+      if (run.len > 0)
+      {
+        literals = lappend(literals, makeString(pstrdup(run.data)));
+        resetStringInfo(&run);
+      }
+      if (*p == '\0')
+        break;
+      continue;
+    }
+
+    if (*p == '\\' && *++p == '\0')
+      break;
+    appendStringInfoChar(&run, *p);
+  }
+
+  pfree(run.data);
+  return literals;
+}
+
+/*
+ * The longest run of literal characters a string matching the advanced
+ * regular expression re contains, or NULL when there's none to be told
+ * without compiling it (alternations, embedded options...).
+ */
+char *gitRegexLiteral(const char *re)
+{
+  StringInfoData run, best;
+  const char *p = re;
+  int last_atom = -1; /* where the run's last character starts */
+
+  /* Directors and embedded options change the rules */
+  if (strncmp(re, "***", 3) == 0 || strncmp(re, "(?", 2) == 0)
+    return NULL;
+
+  initStringInfo(&run);
+  initStringInfo(&best);
+
+  while (*p != '\0')
+  {
+    switch (*p)
+    {
+    case '|':
+      /* Either side may match, the run may not be there */
+      pfree(run.data);
+      pfree(best.data);
+      return NULL;
+    case '*':
+    case '?':
+    case '{':
+      /* The previous atom may not be there at all */
+      if (last_atom >= 0)
+      {
+        run.len = last_atom;
+        run.data[run.len] = '\0';
+      }
+      gitKeepLongest(&run, &best);
+      last_atom = -1;
+      if (*p == '{')
+      {
+        while (*p != '\0' && *p != '}')
+          p++;
+        if (*p == '\0')
+          continue;
+      }
+      p++;
+      continue;
+    case '+':
+      /* The previous atom is there, possibly repeated */
+      gitKeepLongest(&run, &best);
+      last_atom = -1;
+      p++;
+      continue;
+    case '(':
+      gitKeepLongest(&run, &best);
+      last_atom = -1;
+      p = gitSkipGroup(p);
+      continue;
+    case '[':
+      gitKeepLongest(&run, &best);
+      last_atom = -1;
+      p = gitSkipBracket(p);
+      continue;
+    case ')':
+    case '.':
+    case '^':
+    case '$':
+      gitKeepLongest(&run, &best);
+      last_atom = -1;
+      p++;
+      continue;
+    case '\\':
+      /* Escaped punctuation is itself, letters and digits are classes or constraints */
+      if (p[1] == '\0' || isalnum((unsigned char)p[1]))
+      {
+        gitKeepLongest(&run, &best);
+        last_atom = -1;
+        p += p[1] == '\0' ? 1 : 2;
+        continue;
+      }
+      p++;
+      break;
+    default:
+      break;
+    }
+
+    /* A literal character, as many bytes as the encoding says */
+    {
+      int length = pg_mblen(p);
+
+      last_atom = run.len;
+      appendBinaryStringInfo(&run, p, length);
+      p += length;
+    }
+  }
+
+  gitKeepLongest(&run, &best);
+  pfree(run.data);
+
+  if (best.len == 0)
+  {
+    pfree(best.data);
+    return NULL;
+  }
+  return best.data;
+}
+
+/*
+ * What a case-insensitive search for literal can look for byte by byte: its
+ * runs of ASCII characters, lowercased. A few non-ASCII letters lower to
+ * ASCII ones (the Kelvin sign to k, the dotted capital I to i), so i and k
+ * end runs too.
+ */
+List *gitFoldedLiterals(const char *literal)
+{
+  List *literals = NIL;
+  StringInfoData run;
+  const unsigned char *p;
+
+  initStringInfo(&run);
+  for (p = (const unsigned char *)literal;; p++)
+  {
+    char lower = IS_HIGHBIT_SET(*p) ? '\0' : pg_ascii_tolower(*p);
+
+    if (lower == '\0' || lower == 'i' || lower == 'k')
+    {
+      if (run.len > 0)
+      {
+        literals = lappend(literals, makeString(pstrdup(run.data)));
+        resetStringInfo(&run);
+      }
+      if (*p == '\0')
+        break;
+      continue;
+    }
+
+    appendStringInfoChar(&run, lower);
+  }
+
+  pfree(run.data);
+  return literals;
+}
+
+/*
+ * Finds the message of a raw commit object, after the headers. False when
+ * there's no telling where it starts.
+ */
+bool gitRawCommitMessage(const char *data, size_t size, const char **message, size_t *length)
+{
+  const char *end = data + size;
+  const char *p;
+
+  for (p = data; p < end; p++)
+  {
+    p = memchr(p, '\n', end - p);
+    if (p == NULL || p + 1 >= end)
+      break;
+
+    if (p[1] == '\n')
+    {
+      *message = p + 2;
+      *length = end - (p + 2);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Whether literal (lowercase if ignore_case) is somewhere in text */
+bool gitFindMessageLiteral(const char *text, size_t length, const char *literal, size_t literal_length, bool ignore_case)
+{
+  const char *end = text + length;
+  const char *p;
+
+  if (!ignore_case)
+    return gitFindLiteral(text, length, literal, literal_length) != NULL;
+
+  if (literal_length == 0)
+    return true;
+  if (literal_length > length)
+    return false;
+
+  for (p = text; (size_t)(end - p) >= literal_length; p++)
+  {
+    size_t i;
+
+    for (i = 0; i < literal_length; i++)
+    {
+      if (pg_ascii_tolower((unsigned char)p[i]) != literal[i])
+        break;
+    }
+    if (i == literal_length)
+      return true;
+  }
+  return false;
+}
+
+/* Ends run, keeping it if it's the longest so far */
+static void gitKeepLongest(StringInfo run, StringInfo best)
+{
+  if (run->len > best->len)
+  {
+    resetStringInfo(best);
+    appendBinaryStringInfo(best, run->data, run->len);
+  }
+  resetStringInfo(run);
+}
+
+/* Past the parenthesized group starting at p */
+static const char *gitSkipGroup(const char *p)
+{
+  int depth = 0;
+
+  while (*p != '\0')
+  {
+    if (*p == '\\' && p[1] != '\0')
+      p += 2;
+    else if (*p == '[')
+      p = gitSkipBracket(p);
+    else
+    {
+      if (*p == '(')
+        depth++;
+      else if (*p == ')' && --depth == 0)
+        return p + 1;
+      p++;
+    }
+  }
+
+  return p;
+}
+
+/* Past the bracket expression starting at p */
+static const char *gitSkipBracket(const char *p)
+{
+  p++;
+  if (*p == '^')
+    p++;
+  /* A leading ] is a member */
+  if (*p == ']')
+    p++;
+
+  while (*p != '\0' && *p != ']')
+  {
+    /* Escapes work in brackets too */
+    if (*p == '\\' && p[1] != '\0')
+    {
+      p += 2;
+      continue;
+    }
+
+    /* [:alpha:], [.x.] and [=x=] hold their own brackets */
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+    {
+      char delimiter = p[1];
+
+      p += 2;
+      while (*p != '\0' && !(*p == delimiter && p[1] == ']'))
+        p++;
+      if (*p != '\0')
+        p += 2;
+      continue;
+    }
+    p++;
+  }
+
+  return *p == ']' ? p + 1 : p;
+}
@@ -0,0 +1,15 @@
+/*
+ * Conditions on the commit message, checked on the raw commit object.
+ *
+ * The planner reduces LIKE, ILIKE and regular expression conditions to
+ * substrings every matching message contains. The scan looks for them in
+ * the bytes of the commit before decoding or diffing it, and the executor
+ * still rechecks the actual conditions. The search functions are safe to
+ * call off the backend's thread.
+ */
+List *gitLikeLiterals(const char *pattern);
+char *gitRegexLiteral(const char *re);
+List *gitFoldedLiterals(const char *literal);
+
+bool gitRawCommitMessage(const char *data, size_t size, const char **message, size_t *length);
+bool gitFindMessageLiteral(const char *text, size_t length, const char *literal, size_t literal_length, bool ignore_case);
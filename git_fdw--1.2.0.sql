@@ -0,0 +1,100 @@
+\echo Use "CREATE EXTENSION git_fdw" to load this file. \quit
+
+CREATE FUNCTION git_fdw_handler()
+RETURNS fdw_handler
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION git_fdw_validator(text[], oid)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER git_fdw
+  HANDLER git_fdw_handler
+  VALIDATOR git_fdw_validator;
+
+-- Cumulative statistics, needs git_fdw in shared_preload_libraries
+CREATE FUNCTION git_fdw_stat_repositories(
+    OUT path text,
+    OUT branch text,
+    OUT scans bigint,
+    OUT rows_returned bigint,
+    OUT commits_diffed bigint,
+    OUT diff_time double precision,
+    OUT cache_hits bigint,
+    OUT cache_misses bigint,
+    OUT walks_avoided bigint,
+    OUT last_tip text
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION git_fdw_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW git_fdw_stat_repositories AS
+  SELECT *,
+         round(cache_hits::numeric / nullif(cache_hits + cache_misses, 0), 4) AS cache_hit_ratio
+    FROM git_fdw_stat_repositories();
+
+CREATE FUNCTION git_fdw_stat_progress(
+    OUT pid integer,
+    OUT phase text,
+    OUT path text,
+    OUT branch text,
+    OUT commits_done bigint,
+    OUT commits_total bigint
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW git_fdw_stat_progress AS
+  SELECT * FROM git_fdw_stat_progress();
+
+CREATE FUNCTION git_fdw_commit_count(
+    foreign_table regclass,
+    include_ref text,
+    exclude_ref text DEFAULT NULL
+)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION git_fdw_range(
+    foreign_table regclass,
+    from_ref text,
+    to_ref text,
+    OUT sha1 text,
+    OUT message text,
+    OUT name text,
+    OUT email text,
+    OUT commit_date timestamp with time zone,
+    OUT author_name text,
+    OUT author_email text,
+    OUT author_date timestamp with time zone,
+    OUT insertions int,
+    OUT deletions int,
+    OUT files_changed int
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION git_fdw_range_diff(
+    foreign_table regclass,
+    from_ref text,
+    to_ref text,
+    OUT files_changed int,
+    OUT insertions int,
+    OUT deletions int
+)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION git_fdw_stat_reset() FROM PUBLIC;
@@ -7,21 +7,40 @@
 #include <string.h>
 #include <git2.h>
 
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "access/reloptions.h"
 #include "access/sysattr.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
+#include "catalog/pg_namespace.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#if (PG_VERSION_NUM >= 130000)
+#include "commands/progress.h"
+#endif
 #include "commands/vacuum.h"
+#if (PG_VERSION_NUM >= 140000)
+#include "executor/execAsync.h"
+#endif
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
+#include "pgstat.h"
+#if (PG_VERSION_NUM >= 140000)
+#include "storage/latch.h"
+#endif
 
 #if (PG_VERSION_NUM < 120000)
 #include "optimizer/var.h"
@@ -29,18 +48,41 @@
 #include "optimizer/optimizer.h"
 #endif
 
+#include "portability/instr_time.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 #include "plan_state.h"
 #include "execution_state.h"
 #include "options.h"
+#include "stats.h"
+#include "bitmap.h"
+#include "allocator.h"
+#include "grep.h"
+#include "blame.h"
+#include "prefetch.h"
+#include "filter.h"
 
 PG_MODULE_MAGIC;
 
+void _PG_init(void);
+
 PG_FUNCTION_INFO_V1(git_fdw_handler);
 PG_FUNCTION_INFO_V1(git_fdw_validator);
+PG_FUNCTION_INFO_V1(git_fdw_commit_count);
+PG_FUNCTION_INFO_V1(git_fdw_range);
+PG_FUNCTION_INFO_V1(git_fdw_range_diff);
+
+Datum git_fdw_commit_count(PG_FUNCTION_ARGS);
+Datum git_fdw_range(PG_FUNCTION_ARGS);
+Datum git_fdw_range_diff(PG_FUNCTION_ARGS);
 
 #define POSTGRES_TO_UNIX_EPOCH_DAYS (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE)
 #define POSTGRES_TO_UNIX_EPOCH_USECS (POSTGRES_TO_UNIX_EPOCH_DAYS * USECS_PER_DAY)
@@ -50,11 +92,68 @@ PG_FUNCTION_INFO_V1(git_fdw_validator);
 #define PADDING (1 + 1)
 #define SHA1_LENGTH 40
 
-/* How to Get diff of the first commit?
- * see https://stackoverflow.com/questions/40883798/how-to-get-git-diff-of-the-first-commit
- */
+/* Per-phase timing, only paid for under EXPLAIN ANALYZE */
+#define PHASE_START(festate, start)   \
+  do                                  \
+  {                                   \
+    if ((festate)->timing)            \
+      INSTR_TIME_SET_CURRENT(start);  \
+  } while (0)
+
+#define PHASE_END(festate, start, phase)                                    \
+  do                                                                        \
+  {                                                                         \
+    if ((festate)->timing)                                                  \
+    {                                                                       \
+      instr_time phase_end;                                                 \
+      INSTR_TIME_SET_CURRENT(phase_end);                                    \
+      INSTR_TIME_ACCUM_DIFF((festate)->instrumentation.phase, phase_end, start); \
+    }                                                                       \
+  } while (0)
+
+#ifndef TupleDescAttr
+#define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
+#endif
 
-#define EMPTY_REPO_SHA1 "4b825dc642cb6eb9a060e54bf8d69288fbee4904"
+static const struct
+{
+  const char *name;
+  GitFdwColumn column;
+} column_names[] = {
+    {"sha1", GIT_COLUMN_SHA1},
+    {"message", GIT_COLUMN_MESSAGE},
+    {"name", GIT_COLUMN_NAME},
+    {"email", GIT_COLUMN_EMAIL},
+    {"commit_date", GIT_COLUMN_COMMIT_DATE},
+    {"author_name", GIT_COLUMN_AUTHOR_NAME},
+    {"author_email", GIT_COLUMN_AUTHOR_EMAIL},
+    {"author_date", GIT_COLUMN_AUTHOR_DATE},
+    {"insertions", GIT_COLUMN_INSERTIONS},
+    {"deletions", GIT_COLUMN_DELETIONS},
+    {"files_changed", GIT_COLUMN_FILES_CHANGED},
+    {"pattern", GIT_COLUMN_PATTERN},
+    {"path", GIT_COLUMN_PATH},
+    {"line_no", GIT_COLUMN_LINE_NO},
+    {"line", GIT_COLUMN_LINE},
+    {"commit_sha1", GIT_COLUMN_COMMIT_SHA1},
+    {NULL, GIT_COLUMN_UNKNOWN}};
+
+/* Tables created before columns were matched by name were positional */
+static const GitFdwColumn legacy_columns[] = {
+    GIT_COLUMN_SHA1,
+    GIT_COLUMN_MESSAGE,
+    GIT_COLUMN_NAME,
+    GIT_COLUMN_EMAIL,
+    GIT_COLUMN_COMMIT_DATE,
+    GIT_COLUMN_INSERTIONS,
+    GIT_COLUMN_DELETIONS,
+    GIT_COLUMN_FILES_CHANGED};
+
+/* Indexed by GitFdwFetch, how the plan tells the executor */
+static const char *const fetch_names[] = {"oid", "commit", "diff"};
+
+/* Indexed by GitFdwTableKind, values of the kind option */
+static const char *const kind_names[] = {"commits", "grep", "blame", NULL};
 
 typedef enum callback_type
 {
@@ -86,25 +185,86 @@ static void gitExplainForeignScan(ForeignScanState *node, ExplainState *es);
 static TupleTableSlot *gitIterateForeignScan(ForeignScanState *node);
 static void gitReScanForeignScan(ForeignScanState *node);
 static void gitEndForeignScan(ForeignScanState *node);
+
+#if (PG_VERSION_NUM >= 140000)
+static bool gitIsForeignPathAsyncCapable(ForeignPath *path);
+static void gitForeignAsyncRequest(AsyncRequest *areq);
+static void gitForeignAsyncConfigureWait(AsyncRequest *areq);
+static void gitForeignAsyncNotify(AsyncRequest *areq);
+static void gitProduceAsyncRow(AsyncRequest *areq);
+#endif
+
 #if (PG_VERSION_NUM >= 90500)
 static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid);
 #endif
+#if (PG_VERSION_NUM >= 110000)
+static void gitGetForeignUpperPaths(PlannerInfo *root,
+                                    UpperRelationKind stage,
+                                    RelOptInfo *input_rel,
+                                    RelOptInfo *output_rel,
+                                    void *extra);
+static ForeignScan *gitGetAggregatePlan(RelOptInfo *upperrel, List *tlist, Plan *outer_plan);
+static void gitBeginAggregation(ForeignScanState *node, GitFdwExecutionState *festate,
+                                TupleDesc tupdesc, const char *group_keys, List *quals);
+static TupleTableSlot *gitIterateAggregation(ForeignScanState *node, GitFdwExecutionState *festate);
+static void gitAccumulate(ForeignScanState *node, GitFdwExecutionState *festate);
+static bool gitExprIsSafe(Node *node);
+static bool gitGroupKeyTypeSupported(Oid type, Oid collation);
+static GitFdwAggKind gitAggregateKind(Aggref *aggref, Oid *argtype);
+static uint32 gitGroupKeyHash(const void *key, Size keysize);
+static int gitGroupKeyMatch(const void *key1, const void *key2, Size keysize);
+#endif
 
+static void explainCounter(const char *label, int64 value, ExplainState *es);
+static void explainTiming(const char *label, instr_time value, ExplainState *es);
 static bool is_valid_option(const char *option, Oid context);
+static GitFdwColumn gitColumnFromName(const char *name, AttrNumber attnum);
+static GitFdwColumn gitColumnForAttribute(Oid relid, AttrNumber attnum);
+static GitFdwFetch gitColumnFetch(GitFdwColumn column);
+static GitFdwFetch gitFetchForAttributes(Oid relid, Bitmapset *attrs_used);
+static bool gitFetchNextCommit(GitFdwExecutionState *festate, TupleTableSlot *slot);
+#if (PG_VERSION_NUM >= 140000)
+static bool gitFetchNextPrefetched(GitFdwExecutionState *festate, TupleTableSlot *slot);
+#endif
+static void gitMergePrefetchCounters(GitFdwExecutionState *festate);
+static bool gitFetchNextMatch(GitFdwExecutionState *festate, TupleTableSlot *slot);
+static bool gitFetchNextBlameLine(GitFdwExecutionState *festate, TupleTableSlot *slot);
+static GitFdwTableKind gitTableKindFromName(const char *name);
+static char *gitLikePrefix(const char *pattern);
+static List *gitMessagePushdowns(List *pushdowns, Oid opno, char *value);
+static void gitReleaseScan(void *arg);
+static List *gitExtractPushdowns(RelOptInfo *baserel, Oid foreigntableid);
+static bool gitCommitPassesFilters(GitFdwExecutionState *festate, const git_oid *oid);
+static bool gitCommitIsReachable(GitFdwExecutionState *festate, const char *sha1, git_oid *oid);
+static GitFdwIdentity *gitInternIdentity(GitFdwExecutionState *festate, const char *name, const char *email);
+static void gitCommitDiffStats(GitFdwExecutionState *festate, git_commit *commit, GitFdwCommitRow *row);
+static void gitStoreCommitRow(GitFdwExecutionState *festate, TupleTableSlot *slot, const GitFdwCommitRow *row);
 static void gitGetOptions(Oid foreigntableid, GitFdwPlanState *state, List **other_options);
+static void gitCheckTableAccess(Oid relid);
 static void estimate_costs(PlannerInfo *root, RelOptInfo *baserel,
                            GitFdwPlanState *fdw_private,
                            Cost *startup_cost, Cost *total_cost);
 bool gitAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages);
 int gitAcquireSampleRowsFunc(Relation relation, int elevel, HeapTuple *rows, int targrows, double *totalrows, double *totaldeadrows);
-int walkRepository(const char *path,
-                   const char *branch,
-                   const char *git_search_path,
+git_repository *gitOpenRepository(const char *path, const char *git_search_path);
+void gitCloseRepository(git_repository *repo);
+void gitResolveBranch(git_repository *repo, const char *path, const char *branch, git_oid *oid);
+void gitResolveRevision(git_repository *repo, const char *spec, git_oid *oid);
+int walkRepository(git_repository *repo,
+                   const git_oid *tip,
                    void *callback_state,
                    void (*callback)(void *, callback_obj_t *));
 void try_count(void *callback_state, callback_obj_t *obj);
 void acquire_sample_rows_callback(void *callback_state, callback_obj_t *obj);
-int get_size(GitFdwPlanState *fdw_private);
+double get_size(GitFdwPlanState *fdw_private);
+
+void _PG_init(void)
+{
+  gitAllocatorInit();
+  gitGrepInit();
+  gitBlameInit();
+  gitStatsInit();
+}
 
 Datum git_fdw_handler(PG_FUNCTION_ARGS)
 {
@@ -123,11 +283,24 @@ Datum git_fdw_handler(PG_FUNCTION_ARGS)
 
   fdwroutine->AnalyzeForeignTable = gitAnalyzeForeignTable;
 
+#if (PG_VERSION_NUM >= 110000)
+  /* support for aggregates computed by the scan */
+  fdwroutine->GetForeignUpperPaths = gitGetForeignUpperPaths;
+#endif
+
 #if (PG_VERSION_NUM >= 90500)
   /* support for IMPORT FOREIGN SCHEMA */
   fdwroutine->ImportForeignSchema = gitImportForeignSchema;
 #endif
 
+#if (PG_VERSION_NUM >= 140000)
+  /* support for asynchronous execution under an Append */
+  fdwroutine->IsForeignPathAsyncCapable = gitIsForeignPathAsyncCapable;
+  fdwroutine->ForeignAsyncRequest = gitForeignAsyncRequest;
+  fdwroutine->ForeignAsyncConfigureWait = gitForeignAsyncConfigureWait;
+  fdwroutine->ForeignAsyncNotify = gitForeignAsyncNotify;
+#endif
+
   PG_RETURN_POINTER(fdwroutine);
 }
 
@@ -195,6 +368,21 @@ Datum git_fdw_validator(PG_FUNCTION_ARGS)
                  errmsg("conflicting or redundant options")));
       git_search_path = defGetString(def);
     }
+    else if (strcmp(def->defname, "mailmap") == 0)
+    {
+      /* Checks it's a boolean */
+      (void)defGetBoolean(def);
+    }
+    else if (strcmp(def->defname, "async_capable") == 0)
+    {
+      /* Checks it's a boolean */
+      (void)defGetBoolean(def);
+    }
+    else if (strcmp(def->defname, "kind") == 0)
+    {
+      /* Complains about unknown kinds */
+      (void)gitTableKindFromName(defGetString(def));
+    }
     else
       other_options = lappend(other_options, def);
   }
@@ -223,10 +411,31 @@ static bool is_valid_option(const char *option, Oid context)
 static void gitGetOptions(Oid foreigntableid, GitFdwPlanState *state, List **other_options)
 {
   ForeignTable *table;
+  ForeignServer *server;
   List *options;
   ListCell *lc;
 
   table = GetForeignTable(foreigntableid);
+  server = GetForeignServer(table->serverid);
+
+  state->path = NULL;
+  state->branch = NULL;
+  state->git_search_path = NULL;
+  state->mailmap = false;
+  state->kind = GIT_TABLE_COMMITS;
+  state->oldest_commit = NULL;
+  state->async_capable = false;
+
+  /* The table's own options, read below, take precedence */
+  foreach (lc, server->options)
+  {
+    DefElem *def = (DefElem *)lfirst(lc);
+
+    if (strcmp(def->defname, "async_capable") == 0)
+    {
+      state->async_capable = defGetBoolean(def);
+    }
+  }
 
   options = NIL;
   options = list_concat(options, table->options);
@@ -249,6 +458,26 @@ static void gitGetOptions(Oid foreigntableid, GitFdwPlanState *state, List **oth
     {
       state->git_search_path = defGetString(def);
     }
+
+    if (strcmp(def->defname, "mailmap") == 0)
+    {
+      state->mailmap = defGetBoolean(def);
+    }
+
+    if (strcmp(def->defname, "kind") == 0)
+    {
+      state->kind = gitTableKindFromName(defGetString(def));
+    }
+
+    if (strcmp(def->defname, "oldest_commit") == 0)
+    {
+      state->oldest_commit = defGetString(def);
+    }
+
+    if (strcmp(def->defname, "async_capable") == 0)
+    {
+      state->async_capable = defGetBoolean(def);
+    }
   }
 
   if (state->path == NULL)
@@ -264,6 +493,23 @@ static void gitGetOptions(Oid foreigntableid, GitFdwPlanState *state, List **oth
   *other_options = options;
 }
 
+static GitFdwTableKind gitTableKindFromName(const char *name)
+{
+  int kind;
+
+  for (kind = 0; kind_names[kind] != NULL; kind++)
+  {
+    if (strcmp(name, kind_names[kind]) == 0)
+      return (GitFdwTableKind)kind;
+  }
+
+  ereport(ERROR,
+          (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+           errmsg("invalid value for option \"kind\": \"%s\"", name),
+           errhint("Valid values are \"commits\", \"grep\" and \"blame\".")));
+  return GIT_TABLE_COMMITS;
+}
+
 typedef struct try_count_walker_state
 {
   int rows;
@@ -284,22 +530,84 @@ void try_count(void *callback_state, callback_obj_t *obj)
 static void gitGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
 {
   GitFdwPlanState *fdw_private = (GitFdwPlanState *)palloc(sizeof(GitFdwPlanState));
+  List *pushdowns;
+  int i;
+
   gitGetOptions(foreigntableid, fdw_private, &fdw_private->options);
 
+  /* There's no telling how many lines there are before reading them */
+  if (fdw_private->kind != GIT_TABLE_COMMITS)
+  {
+    fdw_private->ntuples = 1000;
+    fdw_private->pages = fdw_private->ntuples;
+    baserel->fdw_private = (void *)fdw_private;
+    baserel->rows = fdw_private->ntuples;
+    return;
+  }
+
+  fdw_private->ntuples = get_size(fdw_private);
+  fdw_private->pages = fdw_private->ntuples;
+
   baserel->fdw_private = (void *)fdw_private;
-  baserel->rows = get_size(fdw_private);
+  baserel->rows = fdw_private->ntuples;
+
+  /* A pushed-down sha1 returns a commit at most */
+  pushdowns = gitExtractPushdowns(baserel, foreigntableid);
+  for (i = 0; i + 1 < list_length(pushdowns); i += 2)
+  {
+    if (strcmp(strVal(list_nth(pushdowns, i)), "sha1") == 0)
+      baserel->rows = 1;
+  }
 }
 
-int get_size(GitFdwPlanState *fdw_private)
+/*
+ * Number of commits reachable from the branch. Counting means walking the
+ * whole history, so the result is remembered in shared memory against the
+ * branch tip and only recomputed once the tip moves.
+ */
+double get_size(GitFdwPlanState *fdw_private)
 {
   try_count_walker_state_t try_count_walker_state = {0, 0};
+  git_repository *repo;
+  git_oid tip;
+  double rows;
+  bool walked = false;
+
+  repo = gitOpenRepository(fdw_private->path, fdw_private->git_search_path);
+
+  PG_TRY();
+  {
+    gitResolveBranch(repo, fdw_private->path, fdw_private->branch, &tip);
+
+    if (!gitStatsLookupSize(fdw_private->path, fdw_private->branch, &tip, &rows))
+    {
+      /* Pack bitmaps, when there are some, count without walking */
+      if (!gitBitmapCountCommits(repo, &tip, NULL, &rows))
+      {
+        gitProgressStart(GIT_FDW_PROGRESS_COUNTING,
+                         fdw_private->path,
+                         fdw_private->branch,
+                         gitStatsEstimateSize(fdw_private->path, fdw_private->branch));
+        walkRepository(repo,
+                       &tip,
+                       &try_count_walker_state,
+                       try_count);
+        gitProgressEnd();
+        rows = try_count_walker_state.rows;
+        walked = true;
+      }
+      gitStatsStoreSize(fdw_private->path, fdw_private->branch, &tip, rows, walked);
+    }
+  }
+  PG_CATCH();
+  {
+    gitCloseRepository(repo);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  gitCloseRepository(repo);
 
-  walkRepository(fdw_private->path,
-                 fdw_private->branch,
-                 fdw_private->git_search_path,
-                 &try_count_walker_state,
-                 try_count);
-  return try_count_walker_state.rows;
+  return rows;
 }
 
 static void gitGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
@@ -310,10 +618,6 @@ static void gitGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid forei
   List *coptions = NIL;
   Path *path;
 
-  int size = get_size(fdw_private);
-  fdw_private->ntuples = size;
-  fdw_private->pages = size;
-
   /* Estimate costs */
   estimate_costs(root, baserel, fdw_private, &startup_cost, &total_cost);
 
@@ -354,9 +658,37 @@ gitGetForeignPlan(PlannerInfo *root,
 {
   ForeignScan *scan;
   Index scan_relid = baserel->relid;
+  Bitmapset *attrs_used = NULL;
+  ListCell *lc;
+
+#if (PG_VERSION_NUM >= 110000)
+  if (IS_UPPER_REL(baserel))
+    return gitGetAggregatePlan(baserel, tlist, outer_plan);
+#endif
+
+  /*
+   * Pushed-down quals are only used to skip commits early, they all stay
+   * in the plan's quals and get rechecked by the executor.
+   */
   scan_clauses = extract_actual_clauses(scan_clauses, false);
 
-  best_path->fdw_private = baserel->fdw_private;
+  /* Only decode as much of each commit as the query looks at */
+#if PG_VERSION_NUM >= 90600
+  pull_varattnos((Node *)baserel->reltarget->exprs, baserel->relid, &attrs_used);
+#else
+  pull_varattnos((Node *)baserel->reltargetlist, baserel->relid, &attrs_used);
+#endif
+  foreach (lc, baserel->baserestrictinfo)
+  {
+    RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+
+    pull_varattnos((Node *)rinfo->clause, baserel->relid, &attrs_used);
+  }
+
+  best_path->fdw_private = gitExtractPushdowns(baserel, foreigntableid);
+  best_path->fdw_private = lappend(best_path->fdw_private, makeString("fetch"));
+  best_path->fdw_private = lappend(best_path->fdw_private,
+                                   makeString(pstrdup(fetch_names[gitFetchForAttributes(foreigntableid, attrs_used)])));
 
   scan = make_foreignscan(
       tlist,
@@ -373,273 +705,2113 @@ gitGetForeignPlan(PlannerInfo *root,
   return scan;
 }
 
-static void gitExplainForeignScan(ForeignScanState *node, ExplainState *es)
+static GitFdwColumn gitColumnFromName(const char *name, AttrNumber attnum)
 {
-  GitFdwPlanState state;
-  List *options;
-  Oid relationId = RelationGetRelid(node->ss.ss_currentRelation);
+  int i;
 
-  gitGetOptions(relationId, &state, &options);
-  ExplainPropertyText("Foreign Git Repository", state.path, es);
-  ExplainPropertyText("Foreign Git Branch", state.branch, es);
-  ExplainPropertyText("Foreign Git Search Path", state.git_search_path, es);
+  for (i = 0; column_names[i].name; i++)
+  {
+    if (strcmp(column_names[i].name, name) == 0)
+      return column_names[i].column;
+  }
+
+  if (attnum >= 1 && attnum <= lengthof(legacy_columns))
+    return legacy_columns[attnum - 1];
+
+  return GIT_COLUMN_UNKNOWN;
 }
 
-static void gitBeginForeignScan(ForeignScanState *node, int eflags)
+static GitFdwColumn gitColumnForAttribute(Oid relid, AttrNumber attnum)
 {
-  GitFdwExecutionState *festate;
-  git_oid oid = {0};
-  git_remote *remote = NULL;
-  int error;
-  const git_remote_head **refs;
-  size_t refs_len, i;
-  git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
-  Oid relationId = RelationGetRelid(node->ss.ss_currentRelation);
-  List *options;
-  GitFdwPlanState state;
+  char *attname;
 
-  git_libgit2_init();
-  gitGetOptions(relationId, &state, &options);
+#if (PG_VERSION_NUM >= 110000)
+  attname = get_attname(relid, attnum, true);
+#else
+  attname = get_attname(relid, attnum);
+#endif
 
-  festate = (GitFdwExecutionState *)palloc(sizeof(GitFdwExecutionState));
-  festate->path = state.path;
-  festate->branch = state.branch;
-  festate->git_search_path = state.git_search_path;
-  festate->repo = NULL;
-  festate->walker = NULL;
+  return attname ? gitColumnFromName(attname, attnum) : GIT_COLUMN_UNKNOWN;
+}
 
-  node->fdw_state = (void *)festate;
+/* How far a commit has to be decoded to fill a column */
+static GitFdwFetch gitColumnFetch(GitFdwColumn column)
+{
+  switch (column)
+  {
+  case GIT_COLUMN_UNKNOWN:
+  case GIT_COLUMN_SHA1:
+  case GIT_COLUMN_PATTERN:
+  case GIT_COLUMN_PATH:
+  case GIT_COLUMN_LINE_NO:
+  case GIT_COLUMN_LINE:
+  case GIT_COLUMN_COMMIT_SHA1:
+    return GIT_FETCH_OID;
+  case GIT_COLUMN_INSERTIONS:
+  case GIT_COLUMN_DELETIONS:
+  case GIT_COLUMN_FILES_CHANGED:
+    return GIT_FETCH_DIFF;
+  default:
+    return GIT_FETCH_COMMIT;
+  }
+}
 
-  if (festate->git_search_path != NULL)
+/*
+ * How far the scan has to decode commits to fill the attributes in
+ * attrs_used (as collected by pull_varattnos). Most queries never look at
+ * the diff stats, and skipping the tree diff is most of a scan's cost.
+ */
+static GitFdwFetch gitFetchForAttributes(Oid relid, Bitmapset *attrs_used)
+{
+  GitFdwFetch fetch = GIT_FETCH_OID;
+  AttrNumber natts = get_relnatts(relid);
+  AttrNumber attnum;
+
+  /* Whole-row references need everything */
+  if (bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, attrs_used))
+    return GIT_FETCH_DIFF;
+
+  for (attnum = 1; attnum <= natts; attnum++)
   {
-    git_libgit2_opts(
-        GIT_OPT_SET_SEARCH_PATH,
-        GIT_CONFIG_LEVEL_GLOBAL,
-        festate->git_search_path);
+    GitFdwFetch column_fetch;
+
+    if (!bms_is_member(attnum - FirstLowInvalidHeapAttributeNumber, attrs_used))
+      continue;
+
+    column_fetch = gitColumnFetch(gitColumnForAttribute(relid, attnum));
+    if (column_fetch > fetch)
+      fetch = column_fetch;
   }
 
-  if (festate->repo == NULL)
+  return fetch;
+}
+
+/*
+ * Look for `author_email = 'constant'`, `sha1 = 'constant'` and, on grep
+ * and blame tables, `pattern = 'constant'` and `path = / LIKE 'constant'`
+ * in the restriction clauses. What we find is passed to the executor through the
+ * plan's fdw_private as a flat list of (filter name, value) String pairs.
+ */
+static List *gitExtractPushdowns(RelOptInfo *baserel, Oid foreigntableid)
+{
+  List *pushdowns = NIL;
+  ListCell *lc;
+
+  foreach (lc, baserel->baserestrictinfo)
   {
-    int repo_opened = -1;
-    if ((repo_opened = git_repository_open(&festate->repo, festate->path)) != GIT_OK)
-    {
-      const git_error *err = giterr_last();
-      ereport(ERROR,
-              (errcode(ERRCODE_FDW_ERROR),
-               errmsg("Failed opening repository: '%s'", festate->path),
-               errdetail("libgit2 returned error code %d: %s.", repo_opened, err->message)));
-      return;
-    }
+    RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+    OpExpr *op;
+    Node *left, *right;
+    Var *var;
+    Const *constant;
+    GitFdwColumn column;
+    char *value;
+
+    if (!IsA(rinfo->clause, OpExpr))
+      continue;
+
+    op = (OpExpr *)rinfo->clause;
+    if ((op->opno != TextEqualOperator &&
+         op->opno != OID_TEXT_LIKE_OP &&
+         op->opno != OID_TEXT_ICLIKE_OP &&
+         op->opno != OID_TEXT_REGEXEQ_OP &&
+         op->opno != OID_TEXT_ICREGEXEQ_OP) ||
+        list_length(op->args) != 2)
+      continue;
+
+#if (PG_VERSION_NUM >= 120000)
+    /* Byte equality is only right for deterministic collations */
+    if (OidIsValid(op->inputcollid) && !get_collation_isdeterministic(op->inputcollid))
+      continue;
+#endif
 
-    error = git_remote_lookup(&remote, festate->repo, festate->path);
-    if (error < 0)
+    left = (Node *)linitial(op->args);
+    right = (Node *)lsecond(op->args);
+    if (IsA(left, RelabelType))
+      left = (Node *)((RelabelType *)left)->arg;
+    if (IsA(right, RelabelType))
+      right = (Node *)((RelabelType *)right)->arg;
+
+    if (IsA(left, Var) && IsA(right, Const))
     {
-      error = git_remote_create_anonymous(&remote, festate->repo, festate->path);
-      if (error < 0)
-      {
-        ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                        errmsg("Call to git_remote_create_anonymous failed"),
-                        errdetail("Error code: %d", error)));
-      }
+      var = (Var *)left;
+      constant = (Const *)right;
     }
-
-    error = git_remote_connect(
-        remote,
-        GIT_DIRECTION_FETCH,
-        &callbacks,
-        NULL
-#if LIBGIT2_VER_MINOR > 24 || LIBGIT2_VER_MAJOR >= 1
-        ,
-        NULL
-#endif
-    );
-    if (error < 0)
+    else if (IsA(right, Var) && IsA(left, Const) && op->opno == TextEqualOperator)
     {
-      ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                      errmsg("Call to git_remote_connect failed"),
-                      errdetail("Error code: %d", error)));
+      var = (Var *)right;
+      constant = (Const *)left;
     }
+    else
+      continue;
 
-    error = git_remote_ls(&refs, &refs_len, remote);
-    if (error < 0)
+    if (var->varno != baserel->relid || var->varlevelsup != 0 || constant->constisnull)
+      continue;
+
+    column = gitColumnForAttribute(foreigntableid, var->varattno);
+    value = TextDatumGetCString(constant->constvalue);
+
+    /* Narrowed down to substrings, searched for in the raw commit */
+    if (column == GIT_COLUMN_MESSAGE)
     {
-      ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                      errmsg("Call to git_remote_ls failed"),
-                      errdetail("Error code: %d", error)));
+      pushdowns = gitMessagePushdowns(pushdowns, op->opno, value);
+      continue;
     }
 
-    for (i = 0; i < refs_len; i++)
+    /* LIKE prefixes only prune the tree, the rest is rechecked */
+    if (column == GIT_COLUMN_PATH && op->opno == OID_TEXT_LIKE_OP)
     {
-      if (0 == strcmp(refs[i]->name, festate->branch))
+      value = gitLikePrefix(value);
+      if (*value != '\0')
       {
-        oid = refs[i]->oid;
-        break;
+        pushdowns = lappend(pushdowns, makeString("path_prefix"));
+        pushdowns = lappend(pushdowns, makeString(value));
       }
+      continue;
     }
 
-    if (git_oid_iszero(&oid))
+    if (op->opno != TextEqualOperator)
+      continue;
+
+    switch (column)
     {
-      ereport(ERROR,
-              (errcode(ERRCODE_FDW_ERROR),
-               errmsg("Couldn't find branch %s", festate->branch)));
+    case GIT_COLUMN_AUTHOR_EMAIL:
+      pushdowns = lappend(pushdowns, makeString("author_email"));
+      pushdowns = lappend(pushdowns, makeString(value));
+      break;
+    case GIT_COLUMN_SHA1:
+      pushdowns = lappend(pushdowns, makeString("sha1"));
+      pushdowns = lappend(pushdowns, makeString(value));
+      break;
+    case GIT_COLUMN_PATTERN:
+      pushdowns = lappend(pushdowns, makeString("pattern"));
+      pushdowns = lappend(pushdowns, makeString(value));
+      break;
+    case GIT_COLUMN_PATH:
+      pushdowns = lappend(pushdowns, makeString("path"));
+      pushdowns = lappend(pushdowns, makeString(value));
+      break;
+    default:
+      break;
     }
-
-    git_remote_free(remote);
-    git_revwalk_new(&(festate->walker), festate->repo);
-    git_revwalk_sorting(festate->walker, GIT_SORT_TOPOLOGICAL);
-    git_revwalk_push(festate->walker, &oid);
   }
+
+  return pushdowns;
+}
+
+/*
+ * Substrings of the message every commit satisfying `message <op> value`
+ * has, which the scan looks for before decoding anything.
+ */
+static List *gitMessagePushdowns(List *pushdowns, Oid opno, char *value)
+{
+  bool ignore_case = opno == OID_TEXT_ICLIKE_OP || opno == OID_TEXT_ICREGEXEQ_OP;
+  List *literals = NIL;
+  ListCell *lc;
+
+  if (opno == TextEqualOperator)
+    literals = list_make1(makeString(value));
+  else if (opno == OID_TEXT_LIKE_OP || opno == OID_TEXT_ICLIKE_OP)
+    literals = gitLikeLiterals(value);
   else
   {
-    ereport(WARNING, (errcode(WARNING), errmsg("Repo is already initialized %p", festate->repo), errdetail("No details.")));
+    char *literal = gitRegexLiteral(value);
+
+    if (literal != NULL)
+      literals = list_make1(makeString(literal));
+  }
+
+  foreach (lc, literals)
+  {
+    char *literal = strVal(lfirst(lc));
+
+    if (*literal == '\0')
+      continue;
+
+    if (ignore_case)
+    {
+      ListCell *folded;
+
+      foreach (folded, gitFoldedLiterals(literal))
+      {
+        pushdowns = lappend(pushdowns, makeString("message_literal_ci"));
+        pushdowns = lappend(pushdowns, lfirst(folded));
+      }
+    }
+    else
+    {
+      pushdowns = lappend(pushdowns, makeString("message_literal"));
+      pushdowns = lappend(pushdowns, makeString(literal));
+    }
   }
+
+  return pushdowns;
 }
 
-static TupleTableSlot *gitIterateForeignScan(ForeignScanState *node)
+/* What every string matching a LIKE pattern (with the default escape) starts with */
+static char *gitLikePrefix(const char *pattern)
 {
-  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
-  TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+  StringInfoData prefix;
+  const char *p;
 
-  git_oid oid;
-  git_commit *commit;
-  git_tree *commit_tree;
-  git_commit *commit_parent;
-  git_tree *commit_parent_tree;
-  git_diff *commit_diff;
-  git_diff_stats *commit_diff_stats;
-  bool commit_parent_needs_free = false;
-  int position;
-
-  /* libgit's output */
-  const char *commit_message;
-  const git_signature *commit_author;
-  const git_oid *commit_sha1;
+  initStringInfo(&prefix);
+  for (p = pattern; *p != '\0' && *p != '%' && *p != '_'; p++)
+  {
+    if (*p == '\\' && *++p == '\0')
+      break;
+    appendStringInfoChar(&prefix, *p);
+  }
 
-  /* input data that will get converted to PG data structures */
-  char *formatted_commit_id;
+  return prefix.data;
+}
 
-  /* PG data structures */
-  Datum sha1, message, name, email, date, insertions = 0, deletions = 0, files_changed = 0;
+static void gitExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+  GitFdwPlanState state;
+  List *options;
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
 
-  ExecClearTuple(slot);
+  gitGetOptions(festate->relid, &state, &options);
+  ExplainPropertyText("Foreign Git Repository", state.path, es);
+  ExplainPropertyText("Foreign Git Branch", state.branch, es);
+  ExplainPropertyText("Foreign Git Search Path", state.git_search_path, es);
 
-  if (git_revwalk_next(&oid, festate->walker) == GIT_OK)
   {
-    if (git_commit_lookup(&commit, festate->repo, &oid))
-    {
-      elog(ERROR, "Failed to lookup the next object\n");
-      return NULL;
-    }
+    ListCell *lc;
 
-    commit_message = git_commit_message(commit);
-    commit_author = git_commit_committer(commit);
-    commit_sha1 = git_commit_id(commit);
-
-    if (git_commit_parent(&commit_parent, commit, 0) == GIT_OK)
+    foreach (lc, festate->author_emails)
     {
-      commit_parent_needs_free = true;
-      git_commit_tree(&commit_parent_tree, commit_parent);
+      ExplainPropertyText("Pushed Down Author Email", strVal(lfirst(lc)), es);
     }
-    else
-    {
-      /* Get diff of the first commit. */
-      git_oid oid_tree_empty;
 
-      if (git_oid_fromstr(&oid_tree_empty, EMPTY_REPO_SHA1) == GIT_OK)
-      {
-        git_tree_lookup(&commit_parent_tree, festate->repo, &oid_tree_empty);
-      }
+    foreach (lc, festate->message_literals)
+    {
+      ExplainPropertyText("Pushed Down Message Substring", strVal(lfirst(lc)), es);
     }
 
-    if (git_commit_tree(&commit_tree, commit) == GIT_OK &&
-        git_diff_tree_to_tree(&commit_diff, festate->repo, commit_parent_tree, commit_tree, NULL) == GIT_OK &&
-        git_diff_get_stats(&commit_diff_stats, commit_diff) == GIT_OK)
+    foreach (lc, festate->message_literals_ci)
     {
-      insertions = git_diff_stats_insertions(commit_diff_stats);
-      deletions = git_diff_stats_deletions(commit_diff_stats);
-      files_changed = git_diff_stats_files_changed(commit_diff_stats);
-
-      git_diff_stats_free(commit_diff_stats);
-      git_diff_free(commit_diff);
-
-      if (commit_parent_needs_free)
-      {
-        git_commit_free(commit_parent);
-      }
+      ExplainPropertyText("Pushed Down Message Substring (Any Case)", strVal(lfirst(lc)), es);
     }
-    git_tree_free(commit_tree);
-    git_tree_free(commit_parent_tree);
+  }
 
-    /* Retrieve string-encoded SHA1 */
-    formatted_commit_id = (char *)palloc(SHA1_LENGTH + 1);
-    git_oid_fmt(formatted_commit_id, commit_sha1);
-    formatted_commit_id[SHA1_LENGTH] = '\0';
+  if (festate->sha1 != NULL)
+    ExplainPropertyText("Pushed Down Sha1", festate->sha1, es);
 
-    sha1 = CStringGetDatum(cstring_to_text_with_len(formatted_commit_id, strlen(formatted_commit_id)));
-    message = CStringGetDatum(cstring_to_text_with_len(commit_message, strlen(commit_message)));
-    name = CStringGetDatum(cstring_to_text_with_len(commit_author->name, strlen(commit_author->name)));
-    email = CStringGetDatum(cstring_to_text_with_len(commit_author->email, strlen(commit_author->email)));
+  if (festate->pattern != NULL)
+    ExplainPropertyText("Pushed Down Pattern", festate->pattern, es);
 
-    date = (commit_author->when.time * 1000000L) - POSTGRES_TO_UNIX_EPOCH_USECS;
+  if (festate->file_path != NULL)
+    ExplainPropertyText("Pushed Down Path", festate->file_path, es);
 
-    git_commit_free(commit);
+  if (festate->path_prefix != NULL)
+    ExplainPropertyText("Pushed Down Path Prefix", festate->path_prefix, es);
 
-    ExecClearTuple(slot);
-
-    position = 0;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-    slot->tts_isnull[position++] = false;
-
-    position = 0;
-    slot->tts_values[position++] = sha1;
-    slot->tts_values[position++] = message;
-    slot->tts_values[position++] = name;
-    slot->tts_values[position++] = email;
-    slot->tts_values[position++] = date;
-    slot->tts_values[position++] = insertions;
-    slot->tts_values[position++] = deletions;
-    slot->tts_values[position++] = files_changed;
-
-    ExecStoreVirtualTuple(slot);
-    return slot;
+  if (state.oldest_commit != NULL && festate->kind == GIT_TABLE_BLAME)
+    ExplainPropertyText("Oldest Commit", state.oldest_commit, es);
+
+  if (festate->aggregation != NULL)
+  {
+    explainCounter("Pushed Down Group Keys", festate->aggregation->nkeys, es);
+    explainCounter("Pushed Down Aggregates", festate->aggregation->naggs, es);
   }
-  else
+
+  if (es->analyze)
   {
-    festate->repo = NULL;
-    festate->walker = NULL;
-    return NULL;
+    GitFdwScanInstrumentation *instrumentation = &festate->instrumentation;
+
+    gitMergePrefetchCounters(festate);
+
+    explainCounter("Commits Walked", instrumentation->commits_walked, es);
+    explainCounter("Commits Filtered", instrumentation->commits_filtered, es);
+    explainCounter("Commits Emitted", instrumentation->commits_emitted, es);
+    explainCounter("Objects Looked Up", instrumentation->objects_looked_up, es);
+    explainCounter("Trees Diffed", instrumentation->trees_diffed, es);
+    explainCounter("Commit Bytes Decoded", instrumentation->commit_bytes, es);
+    explainCounter("libgit2 Memory Bytes", gitAllocatorUsage(), es);
+    explainCounter("Identity Cache Hits", instrumentation->identity_hits, es);
+    explainCounter("Identity Cache Misses", instrumentation->identity_misses, es);
+
+    if (festate->grep != NULL)
+    {
+      const GitFdwGrepCounters *counters = gitGrepCounters(festate->grep);
+
+      explainCounter("Blobs Searched", counters->blobs_searched, es);
+      explainCounter("Blob Bytes Searched", counters->bytes_searched, es);
+      explainCounter("Binary Blobs Skipped", counters->binary_skipped, es);
+      explainCounter("Duplicate Blobs Skipped", counters->duplicates_skipped, es);
+    }
+
+    if (festate->kind == GIT_TABLE_BLAME)
+    {
+      explainCounter("Blame Cache Hits", instrumentation->blame_cache_hits, es);
+      explainCounter("Blame Cache Misses", instrumentation->blame_cache_misses, es);
+    }
+
+    if (es->timing)
+    {
+      explainTiming("Ref Resolution Time", instrumentation->ref_resolution, es);
+      explainTiming("Revwalk Time", instrumentation->revwalk, es);
+      explainTiming("Commit Decode Time", instrumentation->commit_decode, es);
+      explainTiming("Diff Time", instrumentation->diff, es);
+      explainTiming("Tuple Formation Time", instrumentation->tuple_formation, es);
+    }
   }
 }
 
-static void gitReScanForeignScan(ForeignScanState *node)
+static void explainCounter(const char *label, int64 value, ExplainState *es)
 {
+#if (PG_VERSION_NUM >= 110000)
+  ExplainPropertyInteger(label, NULL, value, es);
+#else
+  ExplainPropertyLong(label, (long)value, es);
+#endif
 }
 
-static void gitEndForeignScan(ForeignScanState *node)
+static void explainTiming(const char *label, instr_time value, ExplainState *es)
 {
-  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
-  git_repository_free(festate->repo);
-  festate->repo = NULL;
-  festate->walker = NULL;
-  git_libgit2_shutdown();
+#if (PG_VERSION_NUM >= 110000)
+  ExplainPropertyFloat(label, "ms", INSTR_TIME_GET_MILLISEC(value), 3, es);
+#else
+  ExplainPropertyFloat(label, INSTR_TIME_GET_MILLISEC(value), 3, es);
+#endif
 }
 
-static void estimate_costs(PlannerInfo *root,
-                           RelOptInfo *baserel, GitFdwPlanState *fdw_private, Cost *startup_cost, Cost *total_cost)
+static void gitBeginForeignScan(ForeignScanState *node, int eflags)
 {
+  GitFdwExecutionState *festate;
+  Oid relationId = InvalidOid;
+  TupleDesc tupdesc;
+  List *fdw_private = ((ForeignScan *)node->ss.ps.plan)->fdw_private;
+  List *options;
+  GitFdwPlanState state;
+  HASHCTL identities;
+  instr_time start;
+  char *group_keys = NULL;
+  List *quals = NIL;
+  int i;
 
-  BlockNumber pages = fdw_private->pages;
-  double ntuples = fdw_private->ntuples;
-  Cost run_cost = 0;
-  Cost cpu_per_tuple;
+  festate = (GitFdwExecutionState *)palloc0(sizeof(GitFdwExecutionState));
+  festate->fetch = GIT_FETCH_DIFF;
 
-  *startup_cost = baserel->baserestrictcost.startup;
+  for (i = 0; i + 1 < list_length(fdw_private); i += 2)
+  {
+    char *name = strVal(list_nth(fdw_private, i));
+    Node *value = (Node *)list_nth(fdw_private, i + 1);
+
+    if (strcmp(name, "author_email") == 0)
+      festate->author_emails = lappend(festate->author_emails, value);
+    else if (strcmp(name, "message_literal") == 0)
+      festate->message_literals = lappend(festate->message_literals, value);
+    else if (strcmp(name, "message_literal_ci") == 0)
+      festate->message_literals_ci = lappend(festate->message_literals_ci, value);
+    else if (strcmp(name, "sha1") == 0)
+    {
+      /* With several, the executor's recheck sorts it out */
+      if (festate->sha1 == NULL)
+        festate->sha1 = strVal(value);
+    }
+    else if (strcmp(name, "fetch") == 0)
+    {
+      int fetch;
+
+      for (fetch = GIT_FETCH_OID; fetch <= GIT_FETCH_DIFF; fetch++)
+      {
+        if (strcmp(strVal(value), fetch_names[fetch]) == 0)
+          festate->fetch = (GitFdwFetch)fetch;
+      }
+    }
+    else if (strcmp(name, "pattern") == 0)
+    {
+      if (festate->pattern == NULL)
+        festate->pattern = strVal(value);
+    }
+    else if (strcmp(name, "path_prefix") == 0)
+    {
+      if (festate->path_prefix == NULL)
+        festate->path_prefix = strVal(value);
+    }
+    else if (strcmp(name, "path") == 0)
+    {
+      if (festate->file_path == NULL)
+        festate->file_path = strVal(value);
+    }
+    else if (strcmp(name, "aggregate") == 0)
+      relationId = atooid(strVal(value));
+    else if (strcmp(name, "group_keys") == 0)
+      group_keys = strVal(value);
+    else if (strcmp(name, "quals") == 0)
+      quals = (List *)value;
+  }
+
+  if (node->ss.ss_currentRelation != NULL)
+  {
+    relationId = RelationGetRelid(node->ss.ss_currentRelation);
+    tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+  }
+  else
+  {
+    /* Aggregations have no scan relation, the planner holds the lock */
+    Relation relation = RelationIdGetRelation(relationId);
+
+    if (!RelationIsValid(relation))
+      elog(ERROR, "could not open relation with OID %u", relationId);
+    tupdesc = CreateTupleDescCopy(RelationGetDescr(relation));
+    RelationClose(relation);
+  }
+
+  festate->relid = relationId;
+  gitGetOptions(relationId, &state, &options);
+  festate->kind = state.kind;
+  festate->path = state.path;
+  festate->branch = state.branch;
+  festate->git_search_path = state.git_search_path;
+  festate->repo = NULL;
+  festate->walker = NULL;
+  festate->scan_context = node->ss.ps.state->es_query_cxt;
+  festate->timing = (node->ss.ps.instrument != NULL) || gitStatsEnabled();
+  memset(&festate->instrumentation, 0, sizeof(GitFdwScanInstrumentation));
+
+  node->fdw_state = (void *)festate;
+
+#if (PG_VERSION_NUM >= 90500)
+  {
+    /* EndForeignScan isn't called when the query errors out */
+    MemoryContextCallback *callback = (MemoryContextCallback *)palloc0(sizeof(MemoryContextCallback));
+
+    callback->func = gitReleaseScan;
+    callback->arg = festate;
+    MemoryContextRegisterResetCallback(festate->scan_context, callback);
+  }
+#endif
+
+  festate->ncolumns = tupdesc->natts;
+  festate->columns = (GitFdwColumn *)palloc(sizeof(GitFdwColumn) * tupdesc->natts);
+  for (i = 0; i < tupdesc->natts; i++)
+  {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+    festate->columns[i] = attr->attisdropped
+                              ? GIT_COLUMN_UNKNOWN
+                              : gitColumnFromName(NameStr(attr->attname), i + 1);
+  }
+
+  memset(&identities, 0, sizeof(identities));
+  identities.keysize = IDENTITY_KEY_LENGTH;
+  identities.entrysize = sizeof(GitFdwIdentity);
+  identities.hcxt = festate->scan_context;
+  festate->identities = hash_create("git_fdw identities",
+                                    1024,
+                                    &identities,
+#if (PG_VERSION_NUM >= 140000)
+                                    HASH_ELEM | HASH_STRINGS | HASH_CONTEXT
+#else
+                                    HASH_ELEM | HASH_CONTEXT
+#endif
+  );
+
+  PHASE_START(festate, start);
+  festate->repo = gitOpenRepository(festate->path, festate->git_search_path);
+  festate->libgit2_initialized = true;
+  gitResolveBranch(festate->repo, festate->path, festate->branch, &festate->tip);
+  PHASE_END(festate, start, ref_resolution);
+
+  if (git_repository_odb(&festate->odb, festate->repo) != GIT_OK)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed opening the object database of '%s'", festate->path)));
+  }
+
+  if (state.mailmap)
+  {
+#ifdef HAVE_GIT_MAILMAP
+    /* A repository without a .mailmap simply resolves nothing */
+    if (git_mailmap_from_repository(&festate->mailmap, festate->repo) != GIT_OK)
+      festate->mailmap = NULL;
+#else
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+             errmsg("the mailmap option requires libgit2 0.28 or later")));
+#endif
+  }
+
+  git_revwalk_new(&(festate->walker), festate->repo);
+  git_revwalk_sorting(festate->walker, GIT_SORT_TOPOLOGICAL);
+  git_revwalk_push(festate->walker, &festate->tip);
+
+  if (festate->sha1 != NULL)
+    festate->point_pending = gitCommitIsReachable(festate, festate->sha1, &festate->point);
+
+  /* Without a pattern, the first row reports it. A file is its own prefix. */
+  if (festate->kind == GIT_TABLE_GREP && festate->pattern != NULL)
+    festate->grep = gitGrepBegin(festate->repo, festate->path, festate->pattern,
+                                 festate->file_path != NULL ? festate->file_path : festate->path_prefix);
+
+  if (festate->kind == GIT_TABLE_BLAME && state.oldest_commit != NULL)
+  {
+    gitResolveRevision(festate->repo, state.oldest_commit, &festate->oldest);
+    festate->has_oldest = true;
+  }
+
+  /* Everything a row points to lives here until the next row is fetched */
+  festate->row_context = AllocSetContextCreate(festate->scan_context,
+                                               "git_fdw row",
+                                               ALLOCSET_DEFAULT_MINSIZE,
+                                               ALLOCSET_DEFAULT_INITSIZE,
+                                               ALLOCSET_DEFAULT_MAXSIZE);
+
+#if (PG_VERSION_NUM >= 110000)
+  if (node->ss.ss_currentRelation == NULL)
+    gitBeginAggregation(node, festate, tupdesc, group_keys, quals);
+#endif
+
+#if (PG_VERSION_NUM >= 140000)
+  /* Only set when an Append asked for it, see gitIsForeignPathAsyncCapable */
+  festate->async = node->ss.ps.async_capable &&
+                   festate->kind == GIT_TABLE_COMMITS &&
+                   festate->aggregation == NULL;
+#endif
+
+  gitProgressStart(GIT_FDW_PROGRESS_SCANNING,
+                   festate->path,
+                   festate->branch,
+                   gitStatsEstimateSize(festate->path, festate->branch));
+}
+
+static TupleTableSlot *gitIterateForeignScan(ForeignScanState *node)
+{
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
+  TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+#if (PG_VERSION_NUM >= 110000)
+  if (festate->aggregation != NULL)
+    return gitIterateAggregation(node, festate);
+#endif
+
+  if (festate->kind == GIT_TABLE_GREP)
+    return gitFetchNextMatch(festate, slot) ? slot : NULL;
+
+  if (festate->kind == GIT_TABLE_BLAME)
+    return gitFetchNextBlameLine(festate, slot) ? slot : NULL;
+
+#if (PG_VERSION_NUM >= 140000)
+  if (festate->async)
+  {
+    /* An empty slot tells the Append to wait, or that the walk is over */
+    if (!gitFetchNextPrefetched(festate, slot))
+      return ExecClearTuple(slot);
+    return slot;
+  }
+#endif
+
+  if (!gitFetchNextCommit(festate, slot))
+    return NULL;
+
+  return slot;
+}
+
+/*
+ * Next line matching the pushed-down pattern, in the files of the
+ * pushed-down sha1 or of the branch tip. The first call lists the tree.
+ */
+static bool gitFetchNextMatch(GitFdwExecutionState *festate, TupleTableSlot *slot)
+{
+  MemoryContext old_context;
+  const char *path, *line;
+  int line_no, length;
+  char formatted_commit_id[SHA1_LENGTH + 1];
+  int attnum;
+
+  if (festate->grep == NULL)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Searching a grep table needs a pattern"),
+             errhint("Add a `pattern = '...'` condition to the query.")));
+  }
+
+  ExecClearTuple(slot);
+  MemoryContextReset(festate->row_context);
+
+  /* The search outlives the per-tuple context we're called in */
+  old_context = MemoryContextSwitchTo(festate->scan_context);
+  if (!festate->grep_started)
+  {
+    festate->grep_started = true;
+    if (festate->sha1 == NULL)
+      festate->point = festate->tip;
+    else if (!festate->point_pending)
+    {
+      /* The branch doesn't reach it */
+      MemoryContextSwitchTo(old_context);
+      return false;
+    }
+    festate->point_pending = false;
+    gitGrepStart(festate->grep, &festate->point);
+  }
+
+  if (!gitGrepNext(festate->grep, &path, &line_no, &line, &length))
+  {
+    MemoryContextSwitchTo(old_context);
+    return false;
+  }
+
+  MemoryContextSwitchTo(festate->row_context);
+  for (attnum = 0; attnum < festate->ncolumns; attnum++)
+  {
+    Datum value = (Datum)0;
+    bool isnull = false;
+
+    switch (festate->columns[attnum])
+    {
+    case GIT_COLUMN_SHA1:
+      git_oid_fmt(formatted_commit_id, &festate->point);
+      formatted_commit_id[SHA1_LENGTH] = '\0';
+      value = PointerGetDatum(cstring_to_text_with_len(formatted_commit_id, SHA1_LENGTH));
+      break;
+    case GIT_COLUMN_PATTERN:
+      value = PointerGetDatum(cstring_to_text(festate->pattern));
+      break;
+    case GIT_COLUMN_PATH:
+      value = PointerGetDatum(cstring_to_text(path));
+      break;
+    case GIT_COLUMN_LINE_NO:
+      value = Int32GetDatum(line_no);
+      break;
+    case GIT_COLUMN_LINE:
+      value = PointerGetDatum(cstring_to_text_with_len(line, length));
+      break;
+    default:
+      isnull = true;
+      break;
+    }
+
+    slot->tts_values[attnum] = value;
+    slot->tts_isnull[attnum] = isnull;
+  }
+
+  ExecStoreVirtualTuple(slot);
+  MemoryContextSwitchTo(old_context);
+
+  /* Rows, as far as the statistics go */
+  festate->instrumentation.commits_emitted++;
+  return true;
+}
+
+/*
+ * Next line of the pushed-down file, as of the pushed-down sha1 or the
+ * branch tip. The first call blames the file, or finds it cached.
+ */
+static bool gitFetchNextBlameLine(GitFdwExecutionState *festate, TupleTableSlot *slot)
+{
+  MemoryContext old_context;
+  GitFdwBlameLine line;
+  char formatted_commit_id[SHA1_LENGTH + 1];
+  int attnum;
+
+  if (festate->file_path == NULL)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Reading a blame table needs a path"),
+             errhint("Add a `path = '...'` condition to the query.")));
+  }
+
+  ExecClearTuple(slot);
+  MemoryContextReset(festate->row_context);
+
+  if (!festate->blame_started)
+  {
+    bool mailmap = false;
+    bool cached;
+
+    festate->blame_started = true;
+    if (festate->sha1 == NULL)
+      festate->point = festate->tip;
+    else if (!festate->point_pending)
+      return false;
+    festate->point_pending = false;
+
+#ifdef HAVE_GIT_MAILMAP
+    /* Without a .mailmap, there's nothing to resolve */
+    mailmap = festate->mailmap != NULL;
+#endif
+
+    /* Outlives the per-tuple context we're called in, until released */
+    old_context = MemoryContextSwitchTo(festate->scan_context);
+    festate->blame = gitBlameFile(festate->repo,
+                                  festate->path,
+                                  &festate->point,
+                                  festate->file_path,
+                                  festate->has_oldest ? &festate->oldest : NULL,
+                                  mailmap,
+                                  &cached);
+    MemoryContextSwitchTo(old_context);
+
+    if (cached)
+      festate->instrumentation.blame_cache_hits++;
+    else
+      festate->instrumentation.blame_cache_misses++;
+  }
+
+  /* Not a file at that commit */
+  if (festate->blame == NULL || festate->blame_line >= gitBlameLineCount(festate->blame))
+    return false;
+
+  festate->blame_line++;
+  gitBlameGetLine(festate->blame, festate->blame_line, &line);
+
+  old_context = MemoryContextSwitchTo(festate->row_context);
+  for (attnum = 0; attnum < festate->ncolumns; attnum++)
+  {
+    Datum value = (Datum)0;
+    bool isnull = false;
+
+    switch (festate->columns[attnum])
+    {
+    case GIT_COLUMN_SHA1:
+      git_oid_fmt(formatted_commit_id, &festate->point);
+      formatted_commit_id[SHA1_LENGTH] = '\0';
+      value = PointerGetDatum(cstring_to_text_with_len(formatted_commit_id, SHA1_LENGTH));
+      break;
+    case GIT_COLUMN_PATH:
+      value = PointerGetDatum(cstring_to_text(festate->file_path));
+      break;
+    case GIT_COLUMN_LINE_NO:
+      value = Int32GetDatum(festate->blame_line);
+      break;
+    case GIT_COLUMN_LINE:
+      value = PointerGetDatum(cstring_to_text_with_len(line.content, line.length));
+      break;
+    case GIT_COLUMN_COMMIT_SHA1:
+      if (line.commit == NULL)
+      {
+        isnull = true;
+        break;
+      }
+      git_oid_fmt(formatted_commit_id, line.commit);
+      formatted_commit_id[SHA1_LENGTH] = '\0';
+      value = PointerGetDatum(cstring_to_text_with_len(formatted_commit_id, SHA1_LENGTH));
+      break;
+    case GIT_COLUMN_AUTHOR_NAME:
+      isnull = line.author_name == NULL;
+      if (!isnull)
+        value = PointerGetDatum(cstring_to_text(line.author_name));
+      break;
+    case GIT_COLUMN_AUTHOR_EMAIL:
+      isnull = line.author_email == NULL;
+      if (!isnull)
+        value = PointerGetDatum(cstring_to_text(line.author_email));
+      break;
+    case GIT_COLUMN_COMMIT_DATE:
+      isnull = line.commit == NULL;
+      if (!isnull)
+        value = TimestampTzGetDatum((line.commit_time * 1000000L) - POSTGRES_TO_UNIX_EPOCH_USECS);
+      break;
+    default:
+      isnull = true;
+      break;
+    }
+
+    slot->tts_values[attnum] = value;
+    slot->tts_isnull[attnum] = isnull;
+  }
+
+  ExecStoreVirtualTuple(slot);
+  MemoryContextSwitchTo(old_context);
+
+  festate->instrumentation.commits_emitted++;
+  return true;
+}
+
+/*
+ * Walk to the next commit passing the pushed-down filters and store it in
+ * slot, decoding no more of it than festate->fetch asks for. Returns false
+ * once the walk is over.
+ */
+static bool gitFetchNextCommit(GitFdwExecutionState *festate, TupleTableSlot *slot)
+{
+  GitFdwScanInstrumentation *instrumentation = &festate->instrumentation;
+  MemoryContext old_context;
+
+  git_oid oid;
+  git_commit *commit = NULL;
+  instr_time start;
+  GitFdwCommitRow row;
+
+  ExecClearTuple(slot);
+  MemoryContextReset(festate->row_context);
+  git_commit_free(festate->commit);
+  festate->commit = NULL;
+  gitAllocatorCheckLimit();
+  old_context = MemoryContextSwitchTo(festate->row_context);
+
+  for (;;)
+  {
+    int walked;
+
+    PHASE_START(festate, start);
+    if (festate->sha1 != NULL)
+    {
+      walked = festate->point_pending ? GIT_OK : GIT_ITEROVER;
+      oid = festate->point;
+      festate->point_pending = false;
+    }
+    else
+      walked = git_revwalk_next(&oid, festate->walker);
+    PHASE_END(festate, start, revwalk);
+
+    if (walked != GIT_OK)
+    {
+      MemoryContextSwitchTo(old_context);
+      return false;
+    }
+
+    if (++instrumentation->commits_walked % GIT_FDW_PROGRESS_INTERVAL == 0)
+      gitProgressUpdate(instrumentation->commits_walked);
+
+    PHASE_START(festate, start);
+    if (gitCommitPassesFilters(festate, &oid))
+      break;
+    PHASE_END(festate, start, commit_decode);
+
+    instrumentation->commits_filtered++;
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  memset(&row, 0, sizeof(row));
+  row.oid = oid;
+
+  if (festate->fetch >= GIT_FETCH_COMMIT)
+  {
+    const git_signature *commit_author;
+    const git_signature *commit_committer;
+
+    if (git_commit_lookup(&festate->commit, festate->repo, &oid))
+    {
+      gitAllocatorCheckLimit();
+      elog(ERROR, "Failed to lookup the next object\n");
+      return false;
+    }
+    commit = festate->commit;
+    instrumentation->objects_looked_up++;
+
+    commit_author = git_commit_author(commit);
+    commit_committer = git_commit_committer(commit);
+    row.message = git_commit_message(commit);
+    row.committer_name = commit_committer->name;
+    row.committer_email = commit_committer->email;
+    row.commit_time = commit_committer->when.time;
+    row.author_name = commit_author->name;
+    row.author_email = commit_author->email;
+    row.author_time = commit_author->when.time;
+    instrumentation->commit_bytes += strlen(git_commit_raw_header(commit)) +
+                                     strlen(git_commit_message_raw(commit));
+  }
+  PHASE_END(festate, start, commit_decode);
+
+  if (festate->fetch >= GIT_FETCH_DIFF)
+  {
+    PHASE_START(festate, start);
+    gitCommitDiffStats(festate, commit, &row);
+    gitAllocatorCheckLimit();
+    PHASE_END(festate, start, diff);
+  }
+
+  gitStoreCommitRow(festate, slot, &row);
+  MemoryContextSwitchTo(old_context);
+
+  return true;
+}
+
+/*
+ * Form the tuple of a commit decoded as far as festate->fetch, whether the
+ * scan walked it itself or got it from its prefetching thread.
+ */
+static void gitStoreCommitRow(GitFdwExecutionState *festate, TupleTableSlot *slot, const GitFdwCommitRow *row)
+{
+  /* input data that will get converted to PG data structures */
+  char formatted_commit_id[SHA1_LENGTH + 1];
+  GitFdwIdentity *author = NULL;
+  GitFdwIdentity *committer = NULL;
+  instr_time start;
+  int attnum;
+
+  PHASE_START(festate, start);
+
+  for (attnum = 0; attnum < festate->ncolumns; attnum++)
+  {
+    GitFdwColumn column = festate->columns[attnum];
+    Datum value = (Datum)0;
+    bool isnull = false;
+
+    /* Columns the plan doesn't look at were not decoded */
+    if (gitColumnFetch(column) > festate->fetch)
+      column = GIT_COLUMN_UNKNOWN;
+
+    switch (column)
+    {
+    case GIT_COLUMN_SHA1:
+      /* Retrieve string-encoded SHA1 */
+      git_oid_fmt(formatted_commit_id, &row->oid);
+      formatted_commit_id[SHA1_LENGTH] = '\0';
+      value = PointerGetDatum(cstring_to_text_with_len(formatted_commit_id, SHA1_LENGTH));
+      break;
+    case GIT_COLUMN_MESSAGE:
+      value = PointerGetDatum(cstring_to_text(row->message));
+      break;
+    case GIT_COLUMN_NAME:
+    case GIT_COLUMN_EMAIL:
+      if (committer == NULL)
+        committer = gitInternIdentity(festate, row->committer_name, row->committer_email);
+      value = column == GIT_COLUMN_NAME ? committer->name : committer->email;
+      break;
+    case GIT_COLUMN_AUTHOR_NAME:
+    case GIT_COLUMN_AUTHOR_EMAIL:
+      if (author == NULL)
+        author = gitInternIdentity(festate, row->author_name, row->author_email);
+      value = column == GIT_COLUMN_AUTHOR_NAME ? author->name : author->email;
+      break;
+    case GIT_COLUMN_COMMIT_DATE:
+      value = TimestampTzGetDatum((row->commit_time * 1000000L) - POSTGRES_TO_UNIX_EPOCH_USECS);
+      break;
+    case GIT_COLUMN_AUTHOR_DATE:
+      value = TimestampTzGetDatum((row->author_time * 1000000L) - POSTGRES_TO_UNIX_EPOCH_USECS);
+      break;
+    case GIT_COLUMN_INSERTIONS:
+      value = (Datum)row->insertions;
+      break;
+    case GIT_COLUMN_DELETIONS:
+      value = (Datum)row->deletions;
+      break;
+    case GIT_COLUMN_FILES_CHANGED:
+      value = (Datum)row->files_changed;
+      break;
+    default:
+      isnull = true;
+      break;
+    }
+
+    slot->tts_values[attnum] = value;
+    slot->tts_isnull[attnum] = isnull;
+  }
+
+  ExecStoreVirtualTuple(slot);
+  PHASE_END(festate, start, tuple_formation);
+
+  festate->instrumentation.commits_emitted++;
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * gitFetchNextCommit() for asynchronous scans: the next commit walked by the
+ * scan's thread, started on the first call. Waits for it unless called on
+ * behalf of an async request, in which case false may just mean "not yet":
+ * festate->prefetch_done tells.
+ */
+static bool gitFetchNextPrefetched(GitFdwExecutionState *festate, TupleTableSlot *slot)
+{
+  GitFdwScanInstrumentation *instrumentation = &festate->instrumentation;
+  const GitFdwCommitRow *row;
+  MemoryContext old_context;
+  int64 walked = 0;
+
+  ExecClearTuple(slot);
+  MemoryContextReset(festate->row_context);
+
+  if (festate->prefetch_done)
+    return false;
+
+  if (festate->prefetch == NULL)
+  {
+    GitFdwPrefetchCounters counters;
+    bool mailmap = false;
+
+    /* The branch doesn't reach the pushed-down sha1 */
+    if (festate->sha1 != NULL && !festate->point_pending)
+    {
+      festate->prefetch_done = true;
+      return false;
+    }
+
+#ifdef HAVE_GIT_MAILMAP
+    mailmap = festate->mailmap != NULL;
+#endif
+
+    /* Carried over, gitMergePrefetchCounters() then copies them back */
+    counters.commits_walked = instrumentation->commits_walked;
+    counters.commits_filtered = instrumentation->commits_filtered;
+    counters.objects_looked_up = instrumentation->objects_looked_up;
+    counters.trees_diffed = instrumentation->trees_diffed;
+    counters.commit_bytes = instrumentation->commit_bytes;
+    counters.revwalk = instrumentation->revwalk;
+    counters.commit_decode = instrumentation->commit_decode;
+    counters.diff = instrumentation->diff;
+
+    /* Released by gitReleaseScan(), which runs as scan_context goes */
+    old_context = MemoryContextSwitchTo(festate->scan_context);
+    festate->prefetch = gitPrefetchBegin(festate->path,
+                                         &festate->tip,
+                                         festate->sha1 != NULL ? &festate->point : NULL,
+                                         mailmap,
+                                         festate->fetch,
+                                         festate->author_emails,
+                                         festate->message_literals,
+                                         festate->message_literals_ci,
+                                         festate->timing,
+                                         &counters);
+    MemoryContextSwitchTo(old_context);
+    festate->point_pending = false;
+  }
+
+  for (;;)
+  {
+    bool done;
+
+    row = gitPrefetchNext(festate->prefetch, &walked, &done);
+    if (row != NULL)
+      break;
+
+    if (done)
+    {
+      festate->prefetch_done = true;
+      return false;
+    }
+
+    /* The Append waits on the socket itself */
+    if (festate->in_async_request)
+      return false;
+
+    (void)WaitLatchOrSocket(MyLatch,
+                            WL_LATCH_SET | WL_SOCKET_READABLE | WL_EXIT_ON_PM_DEATH,
+                            gitPrefetchSocket(festate->prefetch),
+                            -1L,
+                            PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  if (walked / GIT_FDW_PROGRESS_INTERVAL > instrumentation->commits_walked / GIT_FDW_PROGRESS_INTERVAL)
+    gitProgressUpdate(walked);
+  instrumentation->commits_walked = walked;
+
+  old_context = MemoryContextSwitchTo(festate->row_context);
+  gitStoreCommitRow(festate, slot, row);
+  MemoryContextSwitchTo(old_context);
+
+  return true;
+}
+#endif
+
+/* What the scan's thread did so far, for EXPLAIN ANALYZE and the stats */
+static void gitMergePrefetchCounters(GitFdwExecutionState *festate)
+{
+  GitFdwScanInstrumentation *instrumentation = &festate->instrumentation;
+  GitFdwPrefetchCounters counters;
+
+  if (festate->prefetch == NULL)
+    return;
+
+  gitPrefetchCounters(festate->prefetch, &counters);
+  instrumentation->commits_walked = counters.commits_walked;
+  instrumentation->commits_filtered = counters.commits_filtered;
+  instrumentation->objects_looked_up = counters.objects_looked_up;
+  instrumentation->trees_diffed = counters.trees_diffed;
+  instrumentation->commit_bytes = counters.commit_bytes;
+  instrumentation->revwalk = counters.revwalk;
+  instrumentation->commit_decode = counters.commit_decode;
+  instrumentation->diff = counters.diff;
+}
+
+static void gitCommitDiffStats(GitFdwExecutionState *festate, git_commit *commit, GitFdwCommitRow *row)
+{
+  size_t insertions, deletions, files_changed;
+
+  if (gitDiffCounts(festate->repo, commit, &insertions, &deletions, &files_changed,
+                    &festate->instrumentation.objects_looked_up,
+                    &festate->instrumentation.trees_diffed))
+  {
+    row->insertions = insertions;
+    row->deletions = deletions;
+    row->files_changed = files_changed;
+  }
+}
+
+/*
+ * Check the pushed-down filters against the raw commit object, before the
+ * commit gets parsed and long before its trees get diffed.
+ */
+static bool gitCommitPassesFilters(GitFdwExecutionState *festate, const git_oid *oid)
+{
+  git_odb_object *raw;
+  const char *data, *name, *email, *message;
+  size_t size, name_length, email_length, message_length;
+  GitFdwIdentity *author = NULL;
+  ListCell *lc;
+
+  if (festate->author_emails == NIL &&
+      festate->message_literals == NIL &&
+      festate->message_literals_ci == NIL)
+    return true;
+
+  /* Let the regular lookup report unreadable objects */
+  if (git_odb_read(&raw, festate->odb, oid) != GIT_OK)
+    return true;
+  festate->instrumentation.objects_looked_up++;
+
+  data = (const char *)git_odb_object_data(raw);
+  size = git_odb_object_size(raw);
+
+  /* A byte search, before anything gets decoded */
+  if (gitRawCommitMessage(data, size, &message, &message_length))
+  {
+    foreach (lc, festate->message_literals)
+    {
+      const char *literal = strVal(lfirst(lc));
+
+      if (!gitFindMessageLiteral(message, message_length, literal, strlen(literal), false))
+      {
+        git_odb_object_free(raw);
+        return false;
+      }
+    }
+
+    foreach (lc, festate->message_literals_ci)
+    {
+      const char *literal = strVal(lfirst(lc));
+
+      if (!gitFindMessageLiteral(message, message_length, literal, strlen(literal), true))
+      {
+        git_odb_object_free(raw);
+        return false;
+      }
+    }
+  }
+
+  if (festate->author_emails != NIL &&
+      gitRawCommitAuthor(data, size, &name, &name_length, &email, &email_length))
+    author = gitInternIdentity(festate,
+                               pnstrdup(name, name_length),
+                               pnstrdup(email, email_length));
+
+  git_odb_object_free(raw);
+
+  /* Unparseable header: don't guess, the executor will recheck */
+  if (author == NULL)
+    return true;
+
+  foreach (lc, festate->author_emails)
+  {
+    const char *expected = strVal(lfirst(lc));
+    text *email = DatumGetTextPP(author->email);
+
+    if (VARSIZE_ANY_EXHDR(email) != strlen(expected) ||
+        memcmp(VARDATA_ANY(email), expected, VARSIZE_ANY_EXHDR(email)) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Resolve a pushed-down sha1 to the commit it names, provided the branch
+ * reaches it. The column holds lowercase hex, anything else matches
+ * nothing.
+ */
+static bool gitCommitIsReachable(GitFdwExecutionState *festate, const char *sha1, git_oid *oid)
+{
+  git_object *object;
+  bool reachable = false;
+  int i;
+
+  if (strlen(sha1) != SHA1_LENGTH)
+    return false;
+
+  for (i = 0; i < SHA1_LENGTH; i++)
+  {
+    if (!((sha1[i] >= '0' && sha1[i] <= '9') || (sha1[i] >= 'a' && sha1[i] <= 'f')))
+      return false;
+  }
+
+  if (git_oid_fromstr(oid, sha1) != GIT_OK)
+    return false;
+
+  if (git_object_lookup(&object, festate->repo, oid, GIT_FDW_OBJECT_COMMIT) != GIT_OK)
+    return false;
+  git_object_free(object);
+  festate->instrumentation.objects_looked_up++;
+
+  if (git_oid_equal(oid, &festate->tip))
+    return true;
+
+  if (!gitBitmapIsReachable(festate->repo, &festate->tip, oid, &reachable))
+    reachable = git_graph_descendant_of(festate->repo, &festate->tip, oid) == 1;
+
+  return reachable;
+}
+
+/*
+ * Identities are few and repeated across many commits: build the (mailmap
+ * resolved) name and email datums once per scan and hand out the same ones.
+ */
+static GitFdwIdentity *gitInternIdentity(GitFdwExecutionState *festate, const char *name, const char *email)
+{
+  char key[IDENTITY_KEY_LENGTH];
+  GitFdwIdentity *identity;
+  MemoryContext old_context;
+  bool found;
+
+  if (snprintf(key, sizeof(key), "%s <%s>", name, email) >= IDENTITY_KEY_LENGTH)
+  {
+    /* Too long to be a key, this one lives as long as the row */
+    identity = (GitFdwIdentity *)palloc(sizeof(GitFdwIdentity));
+    old_context = CurrentMemoryContext;
+    festate->instrumentation.identity_misses++;
+  }
+  else
+  {
+    identity = (GitFdwIdentity *)hash_search(festate->identities, key, HASH_ENTER, &found);
+    if (found)
+    {
+      festate->instrumentation.identity_hits++;
+      return identity;
+    }
+    festate->instrumentation.identity_misses++;
+    old_context = MemoryContextSwitchTo(festate->scan_context);
+  }
+
+#ifdef HAVE_GIT_MAILMAP
+  if (festate->mailmap != NULL)
+  {
+    const char *real_name, *real_email;
+
+    if (git_mailmap_resolve(&real_name, &real_email, festate->mailmap, name, email) == GIT_OK)
+    {
+      name = real_name;
+      email = real_email;
+    }
+  }
+#endif
+
+  identity->name = CStringGetTextDatum(name);
+  identity->email = CStringGetTextDatum(email);
+
+  MemoryContextSwitchTo(old_context);
+  return identity;
+}
+
+/*
+ * Back to the first row. What the scan reads doesn't depend on executor
+ * parameters, so it's the same rows again: listed trees, blames and groups
+ * are kept, walks start over.
+ */
+static void gitReScanForeignScan(ForeignScanState *node)
+{
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
+
+  ExecClearTuple(node->ss.ss_ScanTupleSlot);
+  MemoryContextReset(festate->row_context);
+  git_commit_free(festate->commit);
+  festate->commit = NULL;
+
+  if (festate->aggregation != NULL)
+  {
+    GitFdwAggregation *aggregation = festate->aggregation;
+
+    if (aggregation->accumulated)
+    {
+      if (aggregation->iterating)
+        hash_seq_term(&aggregation->iterator);
+      hash_seq_init(&aggregation->iterator, aggregation->groups);
+      aggregation->iterating = true;
+    }
+    return;
+  }
+
+  if (festate->kind == GIT_TABLE_GREP)
+  {
+    if (festate->grep != NULL)
+      gitGrepRewind(festate->grep);
+    return;
+  }
+
+  if (festate->kind == GIT_TABLE_BLAME)
+  {
+    festate->blame_line = 0;
+    return;
+  }
+
+  /* Its counters carry over to the next thread, see gitFetchNextPrefetched() */
+  gitMergePrefetchCounters(festate);
+  if (festate->prefetch != NULL)
+    gitPrefetchEnd(festate->prefetch);
+  festate->prefetch = NULL;
+  festate->prefetch_done = false;
+
+  git_revwalk_reset(festate->walker);
+  git_revwalk_push(festate->walker, &festate->tip);
+
+  if (festate->sha1 != NULL)
+    festate->point_pending = gitCommitIsReachable(festate, festate->sha1, &festate->point);
+}
+
+static void gitEndForeignScan(ForeignScanState *node)
+{
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
+
+  gitMergePrefetchCounters(festate);
+  gitStatsReportScan(festate->path,
+                     festate->branch,
+                     &festate->tip,
+                     festate->instrumentation.commits_emitted,
+                     festate->instrumentation.trees_diffed,
+                     INSTR_TIME_GET_MILLISEC(festate->instrumentation.diff));
+  gitProgressEnd();
+
+  if (festate->aggregation != NULL)
+  {
+    if (festate->aggregation->iterating)
+      hash_seq_term(&festate->aggregation->iterator);
+    ExecDropSingleTupleTableSlot(festate->aggregation->row);
+    festate->aggregation = NULL;
+  }
+
+  gitReleaseScan(festate);
+}
+
+/* Free the scan's libgit2 handles, at the end of the scan or on error */
+static void gitReleaseScan(void *arg)
+{
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)arg;
+
+  if (!festate->libgit2_initialized)
+    return;
+
+  /* Joined before the allocator goes away with the repository */
+  if (festate->prefetch != NULL)
+    gitPrefetchEnd(festate->prefetch);
+  festate->prefetch = NULL;
+
+  if (festate->grep != NULL)
+    gitGrepEnd(festate->grep);
+  festate->grep = NULL;
+  if (festate->blame != NULL)
+    gitBlameRelease(festate->blame);
+  festate->blame = NULL;
+  git_commit_free(festate->commit);
+#ifdef HAVE_GIT_MAILMAP
+  git_mailmap_free(festate->mailmap);
+  festate->mailmap = NULL;
+#endif
+  git_revwalk_free(festate->walker);
+  git_odb_free(festate->odb);
+  gitCloseRepository(festate->repo);
+  festate->commit = NULL;
+  festate->odb = NULL;
+  festate->repo = NULL;
+  festate->walker = NULL;
+  festate->libgit2_initialized = false;
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * Asynchronous execution.
+ *
+ * Under an Append, commit tables of servers or tables with async_capable
+ * set walk their branch on a thread of their own (see prefetch.c), so that
+ * scans of several repositories proceed at once. The Append waits on the
+ * thread's pipe; rows go through ExecProcNode() as usual so that quals,
+ * projections and EXPLAIN ANALYZE's counts apply.
+ */
+static bool gitIsForeignPathAsyncCapable(ForeignPath *path)
+{
+  RelOptInfo *baserel = path->path.parent;
+  GitFdwPlanState *state;
+
+  /* Aggregations are computed by the scan, in one go */
+  if (baserel->reloptkind != RELOPT_BASEREL)
+    return false;
+
+  state = (GitFdwPlanState *)baserel->fdw_private;
+  return state->async_capable && state->kind == GIT_TABLE_COMMITS;
+}
+
+static void gitForeignAsyncRequest(AsyncRequest *areq)
+{
+  gitProduceAsyncRow(areq);
+}
+
+static void gitForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+  ForeignScanState *node = (ForeignScanState *)areq->requestee;
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
+  AppendState *requestor = (AppendState *)areq->requestor;
+
+  /* Requests are only left pending once the thread runs */
+  Assert(festate->prefetch != NULL);
+
+  AddWaitEventToSet(requestor->as_eventset,
+                    WL_SOCKET_READABLE,
+                    gitPrefetchSocket(festate->prefetch),
+                    NULL,
+                    areq);
+}
+
+static void gitForeignAsyncNotify(AsyncRequest *areq)
+{
+  gitProduceAsyncRow(areq);
+}
+
+static void gitProduceAsyncRow(AsyncRequest *areq)
+{
+  ForeignScanState *node = (ForeignScanState *)areq->requestee;
+  GitFdwExecutionState *festate = (GitFdwExecutionState *)node->fdw_state;
+  TupleTableSlot *result;
+
+  festate->in_async_request = true;
+  result = ExecProcNode(areq->requestee);
+  festate->in_async_request = false;
+
+  if (!TupIsNull(result))
+    ExecAsyncRequestDone(areq, result);
+  else if (festate->prefetch_done)
+    ExecAsyncRequestDone(areq, NULL);
+  else
+    ExecAsyncRequestPending(areq);
+}
+#endif
+
+#if (PG_VERSION_NUM >= 110000)
+/*
+ * Aggregate pushdown.
+ *
+ * count/sum/min/max over commits, optionally grouped, get computed by the
+ * scan itself: it walks the history, evaluates the query's restriction
+ * clauses on each commit and folds the survivors into a hash table, so
+ * only the groups ever leave it. Commits are only decoded as far as the
+ * aggregated columns need, which for count(*) means not at all.
+ */
+static void gitGetForeignUpperPaths(PlannerInfo *root,
+                                    UpperRelationKind stage,
+                                    RelOptInfo *input_rel,
+                                    RelOptInfo *output_rel,
+                                    void *extra)
+{
+  GroupPathExtraData *group_extra = (GroupPathExtraData *)extra;
+  GitFdwPlanState *input_state = (GitFdwPlanState *)input_rel->fdw_private;
+  GitFdwUpperPlanState *upper;
+  PathTarget *target = output_rel->reltarget;
+  RangeTblEntry *rte;
+  Bitmapset *attrs_used = NULL;
+  List *group_exprs = NIL;
+  StringInfoData group_keys;
+  ListCell *lc;
+  double groups;
+  Cost startup_cost;
+  Cost total_cost;
+  Path *path;
+  int i = 0;
+
+  if (stage != UPPERREL_GROUP_AGG || output_rel->fdw_private != NULL)
+    return;
+
+  if (input_rel->reloptkind != RELOPT_BASEREL || input_state == NULL ||
+      input_state->kind != GIT_TABLE_COMMITS)
+    return;
+
+  if (group_extra->patype != PARTITIONWISE_AGGREGATE_NONE ||
+      group_extra->havingQual != NULL ||
+      root->parse->groupingSets != NIL)
+    return;
+
+  rte = planner_rt_fetch(input_rel->relid, root);
+  upper = (GitFdwUpperPlanState *)palloc0(sizeof(GitFdwUpperPlanState));
+  upper->foreigntableid = rte->relid;
+
+  /* Every restriction clause gets evaluated by the scan */
+  foreach (lc, input_rel->baserestrictinfo)
+  {
+    RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+
+    if (!gitExprIsSafe((Node *)rinfo->clause))
+      return;
+
+    upper->quals = lappend(upper->quals, rinfo->clause);
+    pull_varattnos((Node *)rinfo->clause, input_rel->relid, &attrs_used);
+  }
+
+  initStringInfo(&group_keys);
+  foreach (lc, target->exprs)
+  {
+    Expr *expr = (Expr *)lfirst(lc);
+    Index sgref = get_pathtarget_sortgroupref(target, i);
+    Oid argtype;
+
+    if (sgref != 0 && get_sortgroupref_clause_noerr(sgref, root->parse->groupClause) != NULL)
+    {
+      if (list_length(group_exprs) >= GIT_FDW_MAX_GROUP_KEYS ||
+          !gitExprIsSafe((Node *)expr) ||
+          !gitGroupKeyTypeSupported(exprType((Node *)expr), exprCollation((Node *)expr)))
+        return;
+
+      group_exprs = lappend(group_exprs, expr);
+      appendStringInfoChar(&group_keys, '1');
+    }
+    else if (IsA(expr, Aggref) &&
+             gitAggregateKind((Aggref *)expr, &argtype) != GIT_AGG_UNSUPPORTED &&
+             gitExprIsSafe((Node *)((Aggref *)expr)->args))
+    {
+      appendStringInfoChar(&group_keys, '0');
+    }
+    else
+      return;
+
+    pull_varattnos((Node *)expr, input_rel->relid, &attrs_used);
+    upper->tlist = lappend(upper->tlist, makeTargetEntry(expr, i + 1, NULL, false));
+    i++;
+  }
+
+  upper->group_keys = group_keys.data;
+  upper->fetch = gitFetchForAttributes(rte->relid, attrs_used);
+  upper->pushdowns = gitExtractPushdowns(input_rel, rte->relid);
+
+  if (group_exprs == NIL)
+    groups = 1;
+  else
+    groups = estimate_num_groups(root, group_exprs, input_rel->rows, NULL
+#if (PG_VERSION_NUM >= 140000)
+                                 ,
+                                 NULL
+#endif
+    );
+
+  /*
+   * The same walk as the plain scan, minus handing every commit over to an
+   * Agg node. Nothing comes out before the walk is over.
+   */
+  startup_cost = input_rel->baserestrictcost.startup;
+  startup_cost += seq_page_cost * input_state->pages;
+  startup_cost += (input_rel->baserestrictcost.per_tuple +
+                   cpu_operator_cost * list_length(upper->tlist)) *
+                  input_state->ntuples;
+  total_cost = startup_cost + cpu_tuple_cost * groups;
+
+  output_rel->fdw_private = upper;
+
+#if (PG_VERSION_NUM >= 120000)
+  path = (Path *)create_foreign_upper_path(root, output_rel, target,
+                                           groups,
+                                           startup_cost,
+                                           total_cost,
+                                           NIL,  /* no pathkeys */
+                                           NULL, /* no extra plan */
+                                           NIL);
+#else
+  path = (Path *)create_foreignscan_path(root, output_rel, target,
+                                         groups,
+                                         startup_cost,
+                                         total_cost,
+                                         NIL,  /* no pathkeys */
+                                         NULL, /* no outer rel either */
+                                         NULL, /* no extra plan */
+                                         NIL);
+#endif
+
+  add_path(output_rel, path);
+}
+
+/*
+ * The aggregation scan has no scan relation: its tuples are shaped by
+ * fdw_scan_tlist (group keys and Aggrefs). The restriction clauses go
+ * through fdw_private untouched, setrefs would otherwise try to match their
+ * Vars against fdw_scan_tlist.
+ */
+static ForeignScan *gitGetAggregatePlan(RelOptInfo *upperrel, List *tlist, Plan *outer_plan)
+{
+  GitFdwUpperPlanState *upper = (GitFdwUpperPlanState *)upperrel->fdw_private;
+  List *fdw_private = list_copy(upper->pushdowns);
+
+  fdw_private = lappend(fdw_private, makeString("aggregate"));
+  fdw_private = lappend(fdw_private, makeString(psprintf("%u", upper->foreigntableid)));
+  fdw_private = lappend(fdw_private, makeString("group_keys"));
+  fdw_private = lappend(fdw_private, makeString(upper->group_keys));
+  fdw_private = lappend(fdw_private, makeString("fetch"));
+  fdw_private = lappend(fdw_private, makeString(pstrdup(fetch_names[upper->fetch])));
+  fdw_private = lappend(fdw_private, makeString("quals"));
+  fdw_private = lappend(fdw_private, upper->quals);
+
+  return make_foreignscan(tlist,
+                          NIL,
+                          0,
+                          NIL,
+                          fdw_private,
+                          upper->tlist,
+                          NIL,
+                          outer_plan);
+}
+
+static bool gitExprIsUnsafeWalker(Node *node, void *context)
+{
+  if (node == NULL)
+    return false;
+
+  switch (nodeTag(node))
+  {
+  case T_Aggref:
+  case T_GroupingFunc:
+  case T_WindowFunc:
+  case T_SubLink:
+  case T_SubPlan:
+  case T_AlternativeSubPlan:
+  case T_PlaceHolderVar:
+    return true;
+  case T_Param:
+    /* Executor params would need rescans we don't do */
+    if (((Param *)node)->paramkind != PARAM_EXTERN)
+      return true;
+    break;
+  case T_Var:
+    if (((Var *)node)->varlevelsup != 0)
+      return true;
+    break;
+  default:
+    break;
+  }
+
+  return expression_tree_walker(node, gitExprIsUnsafeWalker, context);
+}
+
+/* Can the scan evaluate this on its own, one commit at a time? */
+static bool gitExprIsSafe(Node *node)
+{
+  return !gitExprIsUnsafeWalker(node, NULL);
+}
+
+/* Group keys are hashed and compared by their bytes */
+static bool gitGroupKeyTypeSupported(Oid type, Oid collation)
+{
+  switch (type)
+  {
+  case BOOLOID:
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+  case DATEOID:
+  case TIMESTAMPOID:
+  case TIMESTAMPTZOID:
+    return true;
+  case TEXTOID:
+  case VARCHAROID:
+#if (PG_VERSION_NUM >= 120000)
+    return !OidIsValid(collation) || get_collation_isdeterministic(collation);
+#else
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+/* Integer-like types, for sums and comparisons */
+static int64 gitDatumGetInt64(Datum value, Oid type)
+{
+  switch (type)
+  {
+  case INT2OID:
+    return DatumGetInt16(value);
+  case INT4OID:
+  case DATEOID:
+    return DatumGetInt32(value);
+  default:
+    return DatumGetInt64(value);
+  }
+}
+
+static Datum gitInt64GetDatum(int64 value, Oid type)
+{
+  switch (type)
+  {
+  case INT2OID:
+    return Int16GetDatum((int16)value);
+  case INT4OID:
+  case DATEOID:
+    return Int32GetDatum((int32)value);
+  default:
+    return Int64GetDatum(value);
+  }
+}
+
+static GitFdwAggKind gitAggregateKind(Aggref *aggref, Oid *argtype)
+{
+  char *name;
+
+  *argtype = InvalidOid;
+
+  if (aggref->aggdistinct != NIL ||
+      aggref->aggorder != NIL ||
+      aggref->aggfilter != NULL ||
+      aggref->aggdirectargs != NIL ||
+      aggref->aggvariadic ||
+      aggref->aggkind != AGGKIND_NORMAL ||
+      aggref->aggsplit != AGGSPLIT_SIMPLE)
+    return GIT_AGG_UNSUPPORTED;
+
+  if (get_func_namespace(aggref->aggfnoid) != PG_CATALOG_NAMESPACE)
+    return GIT_AGG_UNSUPPORTED;
+
+  name = get_func_name(aggref->aggfnoid);
+  if (name == NULL)
+    return GIT_AGG_UNSUPPORTED;
+
+  if (aggref->aggstar)
+    return strcmp(name, "count") == 0 ? GIT_AGG_COUNT_STAR : GIT_AGG_UNSUPPORTED;
+
+  if (list_length(aggref->args) != 1)
+    return GIT_AGG_UNSUPPORTED;
+
+  *argtype = exprType((Node *)((TargetEntry *)linitial(aggref->args))->expr);
+
+  if (strcmp(name, "count") == 0)
+    return GIT_AGG_COUNT;
+
+  /* sum(int2) and sum(int4) are bigints, wider types go numeric */
+  if (strcmp(name, "sum") == 0 && (*argtype == INT2OID || *argtype == INT4OID))
+    return GIT_AGG_SUM;
+
+  if (*argtype != INT2OID && *argtype != INT4OID && *argtype != INT8OID &&
+      *argtype != DATEOID && *argtype != TIMESTAMPOID && *argtype != TIMESTAMPTZOID)
+    return GIT_AGG_UNSUPPORTED;
+
+  if (strcmp(name, "min") == 0)
+    return GIT_AGG_MIN;
+  if (strcmp(name, "max") == 0)
+    return GIT_AGG_MAX;
+
+  return GIT_AGG_UNSUPPORTED;
+}
+
+static void gitBeginAggregation(ForeignScanState *node, GitFdwExecutionState *festate,
+                                TupleDesc tupdesc, const char *group_keys, List *quals)
+{
+  ForeignScan *plan = (ForeignScan *)node->ss.ps.plan;
+  GitFdwAggregation *aggregation;
+  HASHCTL groups;
+  ListCell *lc;
+  int i = 0;
+
+  aggregation = (GitFdwAggregation *)palloc0(sizeof(GitFdwAggregation));
+
+  quals = (List *)copyObject(quals);
+  fix_opfuncids((Node *)quals);
+  aggregation->quals = ExecInitQual(quals, &node->ss.ps);
+#if (PG_VERSION_NUM >= 120000)
+  aggregation->row = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
+#else
+  aggregation->row = MakeSingleTupleTableSlot(tupdesc);
+#endif
+
+  aggregation->noutputs = list_length(plan->fdw_scan_tlist);
+  aggregation->outputs = (int *)palloc(sizeof(int) * aggregation->noutputs);
+  aggregation->kinds = (GitFdwAggKind *)palloc(sizeof(GitFdwAggKind) * aggregation->noutputs);
+  aggregation->args = (ExprState **)palloc0(sizeof(ExprState *) * aggregation->noutputs);
+  aggregation->argtypes = (Oid *)palloc(sizeof(Oid) * aggregation->noutputs);
+
+  foreach (lc, plan->fdw_scan_tlist)
+  {
+    TargetEntry *tle = (TargetEntry *)lfirst(lc);
+
+    if (group_keys[i] == '1')
+    {
+      int key = aggregation->nkeys++;
+
+      aggregation->keys[key] = ExecInitExpr(tle->expr, &node->ss.ps);
+      get_typlenbyval(exprType((Node *)tle->expr),
+                      &aggregation->key_typlen[key],
+                      &aggregation->key_byval[key]);
+      aggregation->outputs[i] = key;
+    }
+    else
+    {
+      Aggref *aggref = (Aggref *)tle->expr;
+      int agg = aggregation->naggs++;
+
+      aggregation->kinds[agg] = gitAggregateKind(aggref, &aggregation->argtypes[agg]);
+      if (aggref->args != NIL)
+        aggregation->args[agg] = ExecInitExpr(((TargetEntry *)linitial(aggref->args))->expr,
+                                              &node->ss.ps);
+      aggregation->outputs[i] = -(agg + 1);
+    }
+    i++;
+  }
+
+  memset(&groups, 0, sizeof(groups));
+  groups.keysize = sizeof(GitFdwGroupKey);
+  groups.entrysize = offsetof(GitFdwGroup, values) + sizeof(GitFdwAggValue) * Max(aggregation->naggs, 1);
+  groups.hash = gitGroupKeyHash;
+  groups.match = gitGroupKeyMatch;
+  groups.hcxt = festate->scan_context;
+  aggregation->groups = hash_create("git_fdw groups",
+                                    256,
+                                    &groups,
+                                    HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+  festate->aggregation = aggregation;
+}
+
+static TupleTableSlot *gitIterateAggregation(ForeignScanState *node, GitFdwExecutionState *festate)
+{
+  GitFdwAggregation *aggregation = festate->aggregation;
+  TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+  GitFdwGroup *group;
+  int i;
+
+  if (!aggregation->accumulated)
+  {
+    gitAccumulate(node, festate);
+    aggregation->accumulated = true;
+    aggregation->iterating = true;
+    hash_seq_init(&aggregation->iterator, aggregation->groups);
+  }
+
+  ExecClearTuple(slot);
+
+  if (!aggregation->iterating)
+    return NULL;
+
+  group = (GitFdwGroup *)hash_seq_search(&aggregation->iterator);
+  if (group == NULL)
+  {
+    aggregation->iterating = false;
+    return NULL;
+  }
+
+  for (i = 0; i < aggregation->noutputs; i++)
+  {
+    int output = aggregation->outputs[i];
+    Datum value = (Datum)0;
+    bool isnull = false;
+
+    if (output >= 0)
+    {
+      value = group->key.values[output];
+      isnull = group->key.isnull[output];
+    }
+    else
+    {
+      int agg = -output - 1;
+      GitFdwAggValue *state = &group->values[agg];
+
+      switch (aggregation->kinds[agg])
+      {
+      case GIT_AGG_COUNT_STAR:
+      case GIT_AGG_COUNT:
+        value = Int64GetDatum(state->count);
+        break;
+      case GIT_AGG_SUM:
+        value = Int64GetDatum(state->sum);
+        isnull = state->count == 0;
+        break;
+      case GIT_AGG_MIN:
+      case GIT_AGG_MAX:
+        value = gitInt64GetDatum(state->extreme, aggregation->argtypes[agg]);
+        isnull = state->count == 0;
+        break;
+      default:
+        isnull = true;
+        break;
+      }
+    }
+
+    slot->tts_values[i] = value;
+    slot->tts_isnull[i] = isnull;
+  }
+
+  ExecStoreVirtualTuple(slot);
+  return slot;
+}
+
+static void gitInitGroup(GitFdwExecutionState *festate, GitFdwGroup *group)
+{
+  GitFdwAggregation *aggregation = festate->aggregation;
+  MemoryContext old_context;
+  int i;
+
+  memset(group->values, 0, sizeof(GitFdwAggValue) * aggregation->naggs);
+
+  /* The key still points into the current row */
+  old_context = MemoryContextSwitchTo(festate->scan_context);
+  for (i = 0; i < aggregation->nkeys; i++)
+  {
+    if (!group->key.isnull[i] && !aggregation->key_byval[i])
+      group->key.values[i] = datumCopy(group->key.values[i], false, aggregation->key_typlen[i]);
+  }
+  MemoryContextSwitchTo(old_context);
+}
+
+static void gitAccumulate(ForeignScanState *node, GitFdwExecutionState *festate)
+{
+  GitFdwAggregation *aggregation = festate->aggregation;
+  ExprContext *econtext = node->ss.ps.ps_ExprContext;
+  GitFdwGroupKey key;
+  GitFdwGroup *group;
+  bool found;
+  int i;
+
+  while (gitFetchNextCommit(festate, aggregation->row))
+  {
+    ResetExprContext(econtext);
+    econtext->ecxt_scantuple = aggregation->row;
+
+    if (!ExecQual(aggregation->quals, econtext))
+      continue;
+
+    memset(&key, 0, sizeof(key));
+    key.aggregation = aggregation;
+    for (i = 0; i < aggregation->nkeys; i++)
+    {
+      key.values[i] = ExecEvalExpr(aggregation->keys[i], econtext, &key.isnull[i]);
+      if (key.isnull[i])
+        key.values[i] = (Datum)0;
+    }
+
+    group = (GitFdwGroup *)hash_search(aggregation->groups, &key, HASH_ENTER, &found);
+    if (!found)
+      gitInitGroup(festate, group);
+
+    for (i = 0; i < aggregation->naggs; i++)
+    {
+      GitFdwAggValue *state = &group->values[i];
+      Datum value;
+      bool isnull;
+      int64 number;
+
+      if (aggregation->kinds[i] == GIT_AGG_COUNT_STAR)
+      {
+        state->count++;
+        continue;
+      }
+
+      value = ExecEvalExpr(aggregation->args[i], econtext, &isnull);
+      if (isnull)
+        continue;
+
+      switch (aggregation->kinds[i])
+      {
+      case GIT_AGG_SUM:
+        state->sum += gitDatumGetInt64(value, aggregation->argtypes[i]);
+        break;
+      case GIT_AGG_MIN:
+        number = gitDatumGetInt64(value, aggregation->argtypes[i]);
+        if (state->count == 0 || number < state->extreme)
+          state->extreme = number;
+        break;
+      case GIT_AGG_MAX:
+        number = gitDatumGetInt64(value, aggregation->argtypes[i]);
+        if (state->count == 0 || number > state->extreme)
+          state->extreme = number;
+        break;
+      default:
+        break;
+      }
+      state->count++;
+    }
+  }
+
+  /* Without GROUP BY, even no commits at all make one row */
+  if (aggregation->nkeys == 0 && hash_get_num_entries(aggregation->groups) == 0)
+  {
+    memset(&key, 0, sizeof(key));
+    key.aggregation = aggregation;
+    group = (GitFdwGroup *)hash_search(aggregation->groups, &key, HASH_ENTER, &found);
+    gitInitGroup(festate, group);
+  }
+}
+
+static uint32 gitGroupKeyHash(const void *key, Size keysize)
+{
+  const GitFdwGroupKey *group_key = (const GitFdwGroupKey *)key;
+  const GitFdwAggregation *aggregation = group_key->aggregation;
+  uint32 hash = 0;
+  int i;
+
+  for (i = 0; i < aggregation->nkeys; i++)
+  {
+    uint32 value_hash = 0;
+
+    if (group_key->isnull[i])
+      value_hash = 0;
+    else if (aggregation->key_byval[i])
+      value_hash = DatumGetUInt32(hash_any((const unsigned char *)&group_key->values[i],
+                                           sizeof(Datum)));
+    else if (aggregation->key_typlen[i] > 0)
+      value_hash = DatumGetUInt32(hash_any((const unsigned char *)DatumGetPointer(group_key->values[i]),
+                                           aggregation->key_typlen[i]));
+    else
+    {
+      text *value = DatumGetTextPP(group_key->values[i]);
+
+      value_hash = DatumGetUInt32(hash_any((const unsigned char *)VARDATA_ANY(value),
+                                           VARSIZE_ANY_EXHDR(value)));
+    }
+
+    hash = ((hash << 1) | (hash >> 31)) ^ value_hash;
+  }
+
+  return hash;
+}
+
+static int gitGroupKeyMatch(const void *key1, const void *key2, Size keysize)
+{
+  const GitFdwGroupKey *left = (const GitFdwGroupKey *)key1;
+  const GitFdwGroupKey *right = (const GitFdwGroupKey *)key2;
+  const GitFdwAggregation *aggregation = left->aggregation;
+  int i;
+
+  for (i = 0; i < aggregation->nkeys; i++)
+  {
+    if (left->isnull[i] != right->isnull[i])
+      return 1;
+    if (left->isnull[i])
+      continue;
+
+    if (aggregation->key_byval[i])
+    {
+      if (left->values[i] != right->values[i])
+        return 1;
+    }
+    else if (aggregation->key_typlen[i] > 0)
+    {
+      if (memcmp(DatumGetPointer(left->values[i]),
+                 DatumGetPointer(right->values[i]),
+                 aggregation->key_typlen[i]) != 0)
+        return 1;
+    }
+    else
+    {
+      text *left_value = DatumGetTextPP(left->values[i]);
+      text *right_value = DatumGetTextPP(right->values[i]);
+
+      if (VARSIZE_ANY_EXHDR(left_value) != VARSIZE_ANY_EXHDR(right_value) ||
+          memcmp(VARDATA_ANY(left_value), VARDATA_ANY(right_value), VARSIZE_ANY_EXHDR(left_value)) != 0)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+#endif
+
+static void estimate_costs(PlannerInfo *root,
+                           RelOptInfo *baserel, GitFdwPlanState *fdw_private, Cost *startup_cost, Cost *total_cost)
+{
+
+  BlockNumber pages = fdw_private->pages;
+  double ntuples = fdw_private->ntuples;
+  Cost run_cost = 0;
+  Cost cpu_per_tuple;
+
+  *startup_cost = baserel->baserestrictcost.startup;
 
   run_cost += seq_page_cost * pages;
   cpu_per_tuple = cpu_tuple_cost + baserel->baserestrictcost.per_tuple;
@@ -656,7 +2828,8 @@ static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid
   char *path = "",
        *branch = "",
        *git_search_path = "",
-       *prefix = "";
+       *prefix = "",
+       *mailmap = "false";
   StringInfoData cft_stmt;
 
   if (strcmp(stmt->remote_schema, "git_data") != 0)
@@ -678,6 +2851,8 @@ static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid
       git_search_path = defGetString(def);
     else if (strcmp(def->defname, "prefix") == 0)
       prefix = defGetString(def);
+    else if (strcmp(def->defname, "mailmap") == 0)
+      mailmap = defGetBoolean(def) ? "true" : "false";
     else
       ereport(ERROR,
               (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
@@ -695,12 +2870,36 @@ static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid
                      "\n  name          text,"
                      "\n  email         text,"
                      "\n  commit_date   timestamp with time zone,"
+                     "\n  author_name   text,"
+                     "\n  author_email  text,"
+                     "\n  author_date   timestamp with time zone,"
                      "\n  insertions    int,"
                      "\n  deletions     int,"
                      "\n  files_changed int"
                      "\n)"
                      "\nSERVER %s"
-                     "\nOPTIONS (path '%s',\n branch '%s',\n git_search_path '%s')",
+                     "\nOPTIONS (path '%s',\n branch '%s',\n git_search_path '%s',\n mailmap '%s')",
+                     stmt->local_schema,
+                     prefix,
+                     quote_identifier(stmt->server_name),
+                     path,
+                     branch,
+                     git_search_path,
+                     mailmap);
+
+    commands = lappend(commands, pstrdup(cft_stmt.data));
+
+    resetStringInfo(&cft_stmt);
+    appendStringInfo(&cft_stmt,
+                     "CREATE FOREIGN TABLE %s.%sgrep ("
+                     "\n  sha1          text,"
+                     "\n  pattern       text,"
+                     "\n  path          text,"
+                     "\n  line_no       int,"
+                     "\n  line          text"
+                     "\n)"
+                     "\nSERVER %s"
+                     "\nOPTIONS (path '%s',\n branch '%s',\n git_search_path '%s',\n kind 'grep')",
                      stmt->local_schema,
                      prefix,
                      quote_identifier(stmt->server_name),
@@ -708,6 +2907,30 @@ static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid
                      branch,
                      git_search_path);
 
+    commands = lappend(commands, pstrdup(cft_stmt.data));
+
+    resetStringInfo(&cft_stmt);
+    appendStringInfo(&cft_stmt,
+                     "CREATE FOREIGN TABLE %s.%sblame ("
+                     "\n  sha1          text,"
+                     "\n  path          text,"
+                     "\n  line_no       int,"
+                     "\n  line          text,"
+                     "\n  commit_sha1   text,"
+                     "\n  author_name   text,"
+                     "\n  author_email  text,"
+                     "\n  commit_date   timestamp with time zone"
+                     "\n)"
+                     "\nSERVER %s"
+                     "\nOPTIONS (path '%s',\n branch '%s',\n git_search_path '%s',\n mailmap '%s',\n kind 'blame')",
+                     stmt->local_schema,
+                     prefix,
+                     quote_identifier(stmt->server_name),
+                     path,
+                     branch,
+                     git_search_path,
+                     mailmap);
+
     commands = lappend(commands, pstrdup(cft_stmt.data));
     pfree(cft_stmt.data);
   }
@@ -724,6 +2947,14 @@ static List *gitImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid
 
 bool gitAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages)
 {
+  GitFdwPlanState state;
+  List *options;
+
+  /* Only commits can be sampled */
+  gitGetOptions(RelationGetRelid(relation), &state, &options);
+  if (state.kind != GIT_TABLE_COMMITS)
+    return false;
+
   *func = gitAcquireSampleRowsFunc;
   *totalpages = 1;
   return true;
@@ -739,6 +2970,7 @@ typedef struct acquire_sample_rows_walker_state
   TupleDesc tupDesc;
   Datum *values;
   bool *nulls;
+  MemoryContext tuple_context;
 } acquire_sample_rows_walker_state_t;
 
 void acquire_sample_rows_callback(void *callback_state, callback_obj_t *obj)
@@ -757,9 +2989,18 @@ void acquire_sample_rows_callback(void *callback_state, callback_obj_t *obj)
 
     if (*(cb_state->numrows) < cb_state->target_rows)
     {
+      /* walkRepository resets the current context after every commit */
+      MemoryContext old_context = MemoryContextSwitchTo(cb_state->tuple_context);
+
       cb_state->rows[(*cb_state->numrows)++] = heap_form_tuple(cb_state->tupDesc, cb_state->values, cb_state->nulls);
+      MemoryContextSwitchTo(old_context);
     }
     (*cb_state->total_rows)++;
+
+#if (PG_VERSION_NUM >= 130000)
+    if ((int64)*cb_state->total_rows % GIT_FDW_PROGRESS_INTERVAL == 0)
+      pgstat_progress_update_param(PROGRESS_ANALYZE_BLOCKS_DONE, (int64)*cb_state->total_rows);
+#endif
   }
 }
 
@@ -795,12 +3036,34 @@ int gitAcquireSampleRowsFunc(Relation relation,
         rows,
         tupDesc,
         values,
-        nulls};
-    walkRepository(state.path,
-                   state.branch,
-                   state.git_search_path,
-                   &iter_state,
-                   acquire_sample_rows_callback);
+        nulls,
+        CurrentMemoryContext};
+    git_repository *repo = gitOpenRepository(state.path, state.git_search_path);
+    git_oid tip;
+    double estimate = gitStatsEstimateSize(state.path, state.branch);
+
+    PG_TRY();
+    {
+      gitResolveBranch(repo, state.path, state.branch, &tip);
+
+#if (PG_VERSION_NUM >= 130000)
+      /* Commits stand in for blocks in pg_stat_progress_analyze */
+      pgstat_progress_update_param(PROGRESS_ANALYZE_BLOCKS_TOTAL, (int64)estimate);
+#endif
+      gitProgressStart(GIT_FDW_PROGRESS_SAMPLING, state.path, state.branch, estimate);
+      walkRepository(repo,
+                     &tip,
+                     &iter_state,
+                     acquire_sample_rows_callback);
+      gitProgressEnd();
+    }
+    PG_CATCH();
+    {
+      gitCloseRepository(repo);
+      PG_RE_THROW();
+    }
+    PG_END_TRY();
+    gitCloseRepository(repo);
   }
 
   pfree(values);
@@ -815,20 +3078,11 @@ int gitAcquireSampleRowsFunc(Relation relation,
   return numrows;
 }
 
-int walkRepository(const char *path,
-                   const char *branch,
-                   const char *git_search_path,
-                   void *callback_state,
-                   void (*callback)(void *, callback_obj_t *))
+git_repository *gitOpenRepository(const char *path, const char *git_search_path)
 {
   git_repository *repo = NULL;
-  git_remote *remote = NULL;
-  git_oid oid = {0};
-  int error;
-  const git_remote_head **refs;
-  size_t refs_len, i;
-  git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
-  git_revwalk *walker;
+  int repo_opened = -1;
+
   git_libgit2_init();
 
   if (git_search_path != NULL)
@@ -839,89 +3093,555 @@ int walkRepository(const char *path,
         git_search_path);
   }
 
-  if (repo == NULL)
+  if ((repo_opened = git_repository_open(&repo, path)) != GIT_OK)
+  {
+    const git_error *err = giterr_last();
+    char *message = pstrdup(err != NULL ? err->message : "unknown error");
+
+    gitAllocatorShutdown();
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed opening repository: '%s'", path),
+             errdetail("libgit2 returned error code %d: %s.", repo_opened, message)));
+  }
+
+  return repo;
+}
+
+/* Pairs with gitOpenRepository() */
+void gitCloseRepository(git_repository *repo)
+{
+  git_repository_free(repo);
+  gitAllocatorShutdown();
+}
+
+void gitResolveBranch(git_repository *repo, const char *path, const char *branch, git_oid *oid)
+{
+  git_remote *remote = NULL;
+  int error;
+  const git_remote_head **refs;
+  size_t refs_len, i;
+  git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+
+  memset(oid, 0, sizeof(git_oid));
+
+  error = git_remote_lookup(&remote, repo, path);
+  if (error < 0)
+  {
+    error = git_remote_create_anonymous(&remote, repo, path);
+    if (error < 0)
+    {
+      ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
+                      errmsg("Call to git_remote_create_anonymous failed"),
+                      errdetail("Error code: %d", error)));
+    }
+  }
+
+  error = git_remote_connect(
+      remote,
+      GIT_DIRECTION_FETCH,
+      &callbacks,
+      NULL
+#if LIBGIT2_VER_MINOR > 24 || LIBGIT2_VER_MAJOR >= 1
+      ,
+      NULL
+#endif
+  );
+  if (error < 0)
+  {
+    git_remote_free(remote);
+    ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
+                    errmsg("Call to git_remote_connect failed"),
+                    errdetail("Error code: %d", error)));
+  }
+
+  error = git_remote_ls(&refs, &refs_len, remote);
+  if (error < 0)
   {
-    int repo_opened = -1;
-    if ((repo_opened = git_repository_open(&repo, path)) != GIT_OK)
+    git_remote_free(remote);
+    ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
+                    errmsg("Call to git_remote_ls failed"),
+                    errdetail("Error code: %d", error)));
+  }
+
+  for (i = 0; i < refs_len; i++)
+  {
+    if (0 == strcmp(refs[i]->name, branch))
     {
-      const git_error *err = giterr_last();
-      ereport(ERROR,
-              (errcode(ERRCODE_FDW_ERROR),
-               errmsg("Failed opening repository: '%s'", path),
-               errdetail("libgit2 returned error code %d: %s.", repo_opened, err->message)));
-      return 0;
+      *oid = refs[i]->oid;
+      break;
     }
+  }
 
-    error = git_remote_lookup(&remote, repo, path);
-    if (error < 0)
+  git_remote_free(remote);
+
+  if (git_oid_iszero(oid))
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Couldn't find branch %s", branch)));
+  }
+}
+
+/* Any revision git understands (sha1, ref, `branch~3`...), peeled to a commit */
+void gitResolveRevision(git_repository *repo, const char *spec, git_oid *oid)
+{
+  git_object *object;
+  git_object *commit;
+
+  if (git_revparse_single(&object, repo, spec) != GIT_OK)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Couldn't resolve revision %s", spec)));
+  }
+
+  if (git_object_peel(&commit, object, GIT_FDW_OBJECT_COMMIT) != GIT_OK)
+  {
+    git_object_free(object);
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Revision %s is not a commit", spec)));
+  }
+
+  *oid = *git_object_id(commit);
+  git_object_free(commit);
+  git_object_free(object);
+}
+
+/*
+ * git_fdw_commit_count(foreign_table, include_ref, exclude_ref): how many
+ * commits include_ref reaches that exclude_ref doesn't, like
+ * `git rev-list --count include ^exclude`. Answered from pack bitmaps
+ * when the repository has them.
+ */
+Datum git_fdw_commit_count(PG_FUNCTION_ARGS)
+{
+  Oid relid;
+  GitFdwPlanState state;
+  List *options;
+  git_repository *repo;
+  git_revwalk *volatile walker = NULL;
+  git_oid include, exclude;
+  bool has_exclude = !PG_ARGISNULL(2);
+  double count;
+
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+    PG_RETURN_NULL();
+
+  relid = PG_GETARG_OID(0);
+  gitCheckTableAccess(relid);
+
+  gitGetOptions(relid, &state, &options);
+  repo = gitOpenRepository(state.path, state.git_search_path);
+
+  PG_TRY();
+  {
+    gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(1)), &include);
+    if (has_exclude)
+      gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(2)), &exclude);
+
+    if (!gitBitmapCountCommits(repo, &include, has_exclude ? &exclude : NULL, &count))
     {
-      error = git_remote_create_anonymous(&remote, repo, path);
-      if (error < 0)
+      git_revwalk *new_walker;
+      git_oid oid;
+
+      count = 0;
+      git_revwalk_new(&new_walker, repo);
+      walker = new_walker;
+      git_revwalk_push(walker, &include);
+      if (has_exclude)
+        git_revwalk_hide(walker, &exclude);
+
+      while (git_revwalk_next(&oid, walker) == GIT_OK)
       {
-        ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                        errmsg("Call to git_remote_create_anonymous failed"),
-                        errdetail("Error code: %d", error)));
+        CHECK_FOR_INTERRUPTS();
+        count++;
       }
+      gitAllocatorCheckLimit();
     }
+  }
+  PG_CATCH();
+  {
+    git_revwalk_free(walker);
+    gitCloseRepository(repo);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
 
-    error = git_remote_connect(
-        remote,
-        GIT_DIRECTION_FETCH,
-        &callbacks,
-        NULL
-#if LIBGIT2_VER_MINOR > 24 || LIBGIT2_VER_MAJOR >= 1
-        ,
-        NULL
+  git_revwalk_free(walker);
+  gitCloseRepository(repo);
+
+  PG_RETURN_INT64((int64)count);
+}
+
+#define GIT_FDW_RANGE_COLUMNS 11
+
+/*
+ * git_fdw_range(foreign_table, from_ref, to_ref): the commits to_ref reaches
+ * that from_ref doesn't (all of them when from_ref is NULL), like
+ * `git log from_ref..to_ref`, with the columns of a commit table.
+ */
+Datum git_fdw_range(PG_FUNCTION_ARGS)
+{
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  MemoryContext per_query_ctx;
+  MemoryContext row_context;
+  MemoryContext old_context;
+  Oid relid;
+  GitFdwPlanState state;
+  List *options;
+  git_repository *repo;
+  git_revwalk *volatile walker = NULL;
+  git_commit *volatile commit = NULL;
+#ifdef HAVE_GIT_MAILMAP
+  git_mailmap *volatile mailmap = NULL;
 #endif
-    );
-    if (error < 0)
+  git_oid from, to;
+  bool has_from = !PG_ARGISNULL(1);
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("set-valued function called in context that cannot accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("materialize mode required, but it is not allowed in this context")));
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+  old_context = MemoryContextSwitchTo(per_query_ctx);
+
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = tupdesc;
+
+  MemoryContextSwitchTo(old_context);
+
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(2))
+    return (Datum)0;
+
+  relid = PG_GETARG_OID(0);
+  gitCheckTableAccess(relid);
+
+  gitGetOptions(relid, &state, &options);
+  repo = gitOpenRepository(state.path, state.git_search_path);
+
+  /* Reset after every commit, like the scan's row context */
+  row_context = AllocSetContextCreate(CurrentMemoryContext,
+                                      "git_fdw range",
+                                      ALLOCSET_DEFAULT_MINSIZE,
+                                      ALLOCSET_DEFAULT_INITSIZE,
+                                      ALLOCSET_DEFAULT_MAXSIZE);
+
+  PG_TRY();
+  {
+    git_revwalk *new_walker;
+    git_oid oid;
+
+    gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(2)), &to);
+    if (has_from)
+      gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(1)), &from);
+
+#ifdef HAVE_GIT_MAILMAP
+    /* A repository without a .mailmap simply resolves nothing */
+    if (state.mailmap)
     {
-      ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                      errmsg("Call to git_remote_connect failed"),
-                      errdetail("Error code: %d", error)));
+      git_mailmap *new_mailmap;
+
+      if (git_mailmap_from_repository(&new_mailmap, repo) == GIT_OK)
+        mailmap = new_mailmap;
     }
+#endif
 
-    error = git_remote_ls(&refs, &refs_len, remote);
-    if (error < 0)
+    git_revwalk_new(&new_walker, repo);
+    walker = new_walker;
+    git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL);
+    git_revwalk_push(walker, &to);
+    if (has_from)
+      git_revwalk_hide(walker, &from);
+
+    while (git_revwalk_next(&oid, walker) == GIT_OK)
     {
-      ereport(ERROR, (errcode(ERRCODE_FDW_ERROR),
-                      errmsg("Call to git_remote_ls failed"),
-                      errdetail("Error code: %d", error)));
+      Datum values[GIT_FDW_RANGE_COLUMNS];
+      bool nulls[GIT_FDW_RANGE_COLUMNS];
+      const git_signature *signatures[2];
+      char formatted_commit_id[SHA1_LENGTH + 1];
+      size_t insertions = 0, deletions = 0, files_changed = 0;
+      int64 objects_looked_up = 0, trees_diffed = 0;
+      git_commit *found;
+      int i = 0, s;
+
+      CHECK_FOR_INTERRUPTS();
+      MemoryContextReset(row_context);
+      old_context = MemoryContextSwitchTo(row_context);
+
+      if (git_commit_lookup(&found, repo, &oid) != GIT_OK)
+      {
+        gitAllocatorCheckLimit();
+        elog(ERROR, "Failed to lookup the next object\n");
+      }
+      commit = found;
+
+      gitDiffCounts(repo, commit, &insertions, &deletions, &files_changed,
+                    &objects_looked_up, &trees_diffed);
+      gitAllocatorCheckLimit();
+
+      memset(nulls, 0, sizeof(nulls));
+
+      git_oid_fmt(formatted_commit_id, &oid);
+      formatted_commit_id[SHA1_LENGTH] = '\0';
+      values[i++] = PointerGetDatum(cstring_to_text_with_len(formatted_commit_id, SHA1_LENGTH));
+      values[i++] = PointerGetDatum(cstring_to_text(git_commit_message(commit)));
+
+      /* Committer, then author: name, email and date */
+      signatures[0] = git_commit_committer(commit);
+      signatures[1] = git_commit_author(commit);
+      for (s = 0; s < 2; s++)
+      {
+        const char *name = signatures[s]->name;
+        const char *email = signatures[s]->email;
+
+#ifdef HAVE_GIT_MAILMAP
+        if (mailmap != NULL)
+        {
+          const char *real_name, *real_email;
+
+          if (git_mailmap_resolve(&real_name, &real_email, mailmap, name, email) == GIT_OK)
+          {
+            name = real_name;
+            email = real_email;
+          }
+        }
+#endif
+
+        values[i++] = CStringGetTextDatum(name);
+        values[i++] = CStringGetTextDatum(email);
+        values[i++] = TimestampTzGetDatum((signatures[s]->when.time * 1000000L) - POSTGRES_TO_UNIX_EPOCH_USECS);
+      }
+
+      values[i++] = Int32GetDatum((int32)insertions);
+      values[i++] = Int32GetDatum((int32)deletions);
+      values[i++] = Int32GetDatum((int32)files_changed);
+
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+      MemoryContextSwitchTo(old_context);
+      git_commit_free(commit);
+      commit = NULL;
+    }
+    gitAllocatorCheckLimit();
+  }
+  PG_CATCH();
+  {
+    git_commit_free(commit);
+#ifdef HAVE_GIT_MAILMAP
+    git_mailmap_free(mailmap);
+#endif
+    git_revwalk_free(walker);
+    gitCloseRepository(repo);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+#ifdef HAVE_GIT_MAILMAP
+  git_mailmap_free(mailmap);
+#endif
+  git_revwalk_free(walker);
+  gitCloseRepository(repo);
+  MemoryContextDelete(row_context);
+
+  return (Datum)0;
+}
+
+/*
+ * git_fdw_range_diff(foreign_table, from_ref, to_ref): files changed, lines
+ * added and removed between the trees of from_ref (or an empty one when
+ * NULL) and to_ref, like `git diff --shortstat from_ref to_ref`.
+ */
+Datum git_fdw_range_diff(PG_FUNCTION_ARGS)
+{
+  TupleDesc tupdesc;
+  Datum values[3];
+  bool nulls[3];
+  Oid relid;
+  GitFdwPlanState state;
+  List *options;
+  git_repository *repo;
+  git_commit *volatile from_commit = NULL;
+  git_commit *volatile to_commit = NULL;
+  git_tree *volatile from_tree = NULL;
+  git_tree *volatile to_tree = NULL;
+  git_diff *volatile diff = NULL;
+  git_diff_stats *volatile stats = NULL;
+  bool has_from = !PG_ARGISNULL(1);
+
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(2))
+    PG_RETURN_NULL();
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+  tupdesc = BlessTupleDesc(tupdesc);
+
+  relid = PG_GETARG_OID(0);
+  gitCheckTableAccess(relid);
+
+  gitGetOptions(relid, &state, &options);
+  repo = gitOpenRepository(state.path, state.git_search_path);
+
+  PG_TRY();
+  {
+    git_oid from, to;
+    git_commit *commit;
+    git_tree *tree;
+    git_diff *new_diff;
+    git_diff_stats *new_stats;
+    bool ok;
+
+    gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(2)), &to);
+    if (has_from)
+      gitResolveRevision(repo, text_to_cstring(PG_GETARG_TEXT_PP(1)), &from);
+
+    /* Each handle is kept as soon as it's there, for PG_CATCH to free */
+    ok = git_commit_lookup(&commit, repo, &to) == GIT_OK;
+    if (ok)
+    {
+      to_commit = commit;
+      ok = git_commit_tree(&tree, commit) == GIT_OK;
     }
+    if (ok)
+      to_tree = tree;
 
-    for (i = 0; i < refs_len; i++)
+    if (ok && has_from)
     {
-      if (0 == strcmp(refs[i]->name, branch))
+      ok = git_commit_lookup(&commit, repo, &from) == GIT_OK;
+      if (ok)
       {
-        oid = refs[i]->oid;
-        break;
+        from_commit = commit;
+        ok = git_commit_tree(&tree, commit) == GIT_OK;
+      }
+      if (ok)
+        from_tree = tree;
+    }
+
+    /* A NULL old tree diffs against an empty one */
+    if (ok)
+    {
+      ok = git_diff_tree_to_tree(&new_diff, repo, from_tree, to_tree, NULL) == GIT_OK;
+      if (ok)
+      {
+        diff = new_diff;
+        ok = git_diff_get_stats(&new_stats, new_diff) == GIT_OK;
       }
+      if (ok)
+        stats = new_stats;
     }
 
-    if (git_oid_iszero(&oid))
+    if (!ok)
     {
+      gitAllocatorCheckLimit();
       ereport(ERROR,
               (errcode(ERRCODE_FDW_ERROR),
-               errmsg("Couldn't find branch %s", branch)));
+               errmsg("Failed to diff the trees of %s", state.path)));
     }
 
-    git_remote_free(remote);
-    git_revwalk_new(&walker, repo);
-    git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
-    git_revwalk_push_head(walker);
+    memset(nulls, 0, sizeof(nulls));
+    values[0] = Int32GetDatum((int32)git_diff_stats_files_changed(stats));
+    values[1] = Int32GetDatum((int32)git_diff_stats_insertions(stats));
+    values[2] = Int32GetDatum((int32)git_diff_stats_deletions(stats));
+  }
+  PG_CATCH();
+  {
+    git_diff_stats_free(stats);
+    git_diff_free(diff);
+    git_tree_free(to_tree);
+    git_tree_free(from_tree);
+    git_commit_free(to_commit);
+    git_commit_free(from_commit);
+    gitCloseRepository(repo);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  git_diff_stats_free(stats);
+  git_diff_free(diff);
+  git_tree_free(to_tree);
+  git_tree_free(from_tree);
+  git_commit_free(to_commit);
+  git_commit_free(from_commit);
+  gitCloseRepository(repo);
+
+  PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/* The functions taking a foreign table read it as much as a SELECT would */
+static void gitCheckTableAccess(Oid relid)
+{
+  if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+             errmsg("permission denied for foreign table %s", get_rel_name(relid))));
+  }
+}
 
+int walkRepository(git_repository *repo,
+                   const git_oid *tip,
+                   void *callback_state,
+                   void (*callback)(void *, callback_obj_t *))
+{
+  git_oid oid;
+  git_revwalk *walker;
+  git_commit *volatile commit = NULL;
+  MemoryContext walk_context;
+  MemoryContext old_context;
+  int64 walked = 0;
+
+  /* Callbacks allocate in here, it gets reset after every commit */
+  walk_context = AllocSetContextCreate(CurrentMemoryContext,
+                                       "git_fdw walk",
+                                       ALLOCSET_DEFAULT_MINSIZE,
+                                       ALLOCSET_DEFAULT_INITSIZE,
+                                       ALLOCSET_DEFAULT_MAXSIZE);
+
+  git_revwalk_new(&walker, repo);
+  git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+  git_revwalk_push(walker, tip);
+
+  PG_TRY();
+  {
     while (git_revwalk_next(&oid, walker) == 0)
     {
-      git_commit *commit;
-      int error = git_commit_lookup(&commit, repo, &oid);
+      git_commit *found;
+      int error;
       callback_obj_t obj;
 
+      CHECK_FOR_INTERRUPTS();
+      gitAllocatorCheckLimit();
+
+      if (++walked % GIT_FDW_PROGRESS_INTERVAL == 0)
+        gitProgressUpdate(walked);
+
+      MemoryContextReset(walk_context);
+      old_context = MemoryContextSwitchTo(walk_context);
+
+      error = git_commit_lookup(&found, repo, &oid);
       if (0 == error)
       {
+        /* Callbacks may error out, don't lose the commit then */
+        commit = found;
         obj.type = CBT_COMMIT;
         obj.data = (void *)commit;
         (*callback)(callback_state, &obj);
         git_commit_free(commit);
+        commit = NULL;
       }
       else
       {
@@ -929,7 +3649,22 @@ int walkRepository(const char *path,
         obj.data = NULL;
         (*callback)(callback_state, &obj);
       }
+
+      MemoryContextSwitchTo(old_context);
     }
+
+    /* The walk also stops when libgit2 runs out of memory */
+    gitAllocatorCheckLimit();
   }
+  PG_CATCH();
+  {
+    git_commit_free(commit);
+    git_revwalk_free(walker);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  git_revwalk_free(walker);
+  MemoryContextDelete(walk_context);
   return 0;
 }
@@ -0,0 +1,790 @@
+#include "postgres.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <git2.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "miscadmin.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "port/atomics.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "allocator.h"
+#include "grep.h"
+
+/* Blobs searched between two rounds of returning rows */
+#define GREP_BATCH_BLOBS 256
+#define GREP_MAX_WORKERS 64
+
+#define GREP_REGEX_FLAGS (REG_EXTENDED | REG_NOSUB)
+
+static int git_fdw_grep_workers = 4;
+
+typedef struct GitFdwGrepBlob
+{
+  git_oid oid;
+  List *paths;         /* where the blob is found, in tree order */
+  char *matches;       /* (line number, length, line) records, malloc'd */
+  size_t matches_len;
+  size_t matches_size;
+  bool failed;         /* couldn't be read, or no memory for the matches */
+} GitFdwGrepBlob;
+
+typedef struct GitFdwGrepSeen
+{
+  git_oid oid; /* hash key, must be first */
+  int blob;
+} GitFdwGrepSeen;
+
+struct GitFdwGrep
+{
+  git_repository *repo;
+  char *path; /* of the repository, for the workers' own handles */
+  char *pattern;
+  char *literal; /* a substring of every match, NULL if none is known */
+  size_t literal_len;
+  bool pure_literal; /* the pattern matches the literal and nothing else */
+  regex_t regex;
+  bool has_regex;
+  char *path_prefix;
+
+  List *trees; /* being listed, outermost first, kept here to be freed on error */
+  GitFdwGrepBlob *blobs;
+  int nblobs;
+  int blobs_size;
+  HTAB *seen;
+
+  /* Blobs being searched or returned, [batch_start, batch_end) */
+  int batch_start;
+  int batch_end;
+  pg_atomic_uint32 next_blob;
+  pg_atomic_uint32 cancel;
+
+  git_repository *worker_repos[GREP_MAX_WORKERS];
+
+  /* Next row to return */
+  int blob;
+  int path_index;
+  size_t offset;
+
+  GitFdwGrepCounters counters;
+};
+
+typedef struct GitFdwGrepWorker
+{
+  GitFdwGrep *grep;
+  git_repository *repo;
+  pthread_t thread;
+  GitFdwGrepCounters counters;
+} GitFdwGrepWorker;
+
+static char *gitGrepLiteral(const char *pattern, size_t *length, bool *pure);
+static const char *gitGrepSkipBracket(const char *p);
+static bool gitGrepUnderPrefix(const char *prefix, const char *path, bool directory);
+static void gitGrepListTree(GitFdwGrep *grep, const git_oid *oid, const char *path);
+static void gitGrepAddBlob(GitFdwGrep *grep, const git_oid *oid, const char *path);
+static bool gitGrepNextBatch(GitFdwGrep *grep);
+static void gitGrepWork(GitFdwGrep *grep, git_repository *repo, regex_t *regex,
+                        GitFdwGrepCounters *counters, bool backend);
+static void *gitGrepWorkerMain(void *arg);
+static void gitGrepSearchBlob(GitFdwGrep *grep, git_repository *repo, regex_t *regex,
+                              GitFdwGrepBlob *blob, GitFdwGrepCounters *counters);
+static bool gitGrepAppend(GitFdwGrepBlob *blob, int line_no, const char *line, size_t length);
+
+void gitGrepInit(void)
+{
+  DefineCustomIntVariable("git_fdw.grep_workers",
+                          "Sets the number of threads searching blobs for a grep table.",
+                          "The backend itself is one of them.",
+                          &git_fdw_grep_workers,
+                          4,
+                          1,
+                          GREP_MAX_WORKERS,
+                          PGC_USERSET,
+                          0,
+                          NULL,
+                          NULL,
+                          NULL);
+}
+
+GitFdwGrep *gitGrepBegin(git_repository *repo, const char *path, const char *pattern, const char *path_prefix)
+{
+  GitFdwGrep *grep = (GitFdwGrep *)palloc0(sizeof(GitFdwGrep));
+  HASHCTL seen;
+
+  grep->repo = repo;
+  grep->path = pstrdup(path);
+  grep->pattern = pstrdup(pattern);
+  grep->path_prefix = path_prefix ? pstrdup(path_prefix) : NULL;
+  grep->literal = gitGrepLiteral(pattern, &grep->literal_len, &grep->pure_literal);
+
+  if (!grep->pure_literal)
+  {
+    int error = regcomp(&grep->regex, pattern, GREP_REGEX_FLAGS);
+
+    if (error != 0)
+    {
+      char message[256];
+
+      regerror(error, &grep->regex, message, sizeof(message));
+      ereport(ERROR,
+              (errcode(ERRCODE_INVALID_REGULAR_EXPRESSION),
+               errmsg("invalid regular expression: %s", message)));
+    }
+    grep->has_regex = true;
+  }
+
+  grep->blobs_size = 1024;
+  grep->blobs = (GitFdwGrepBlob *)palloc0(sizeof(GitFdwGrepBlob) * grep->blobs_size);
+
+  memset(&seen, 0, sizeof(seen));
+  seen.keysize = sizeof(git_oid);
+  seen.entrysize = sizeof(GitFdwGrepSeen);
+  seen.hcxt = CurrentMemoryContext;
+#if (PG_VERSION_NUM >= 90500)
+  grep->seen = hash_create("git_fdw grep blobs", 1024, &seen,
+                           HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+#else
+  seen.hash = tag_hash;
+  grep->seen = hash_create("git_fdw grep blobs", 1024, &seen,
+                           HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+#endif
+
+  pg_atomic_init_u32(&grep->next_blob, 0);
+  pg_atomic_init_u32(&grep->cancel, 0);
+
+  return grep;
+}
+
+/*
+ * Longest run of characters every match of the extended regular expression
+ * contains: lines without it never reach the regex engine. Anything this
+ * doesn't understand (alternations, groups, brackets) just ends the run.
+ * *pure is set when the pattern is that run and nothing else.
+ */
+static char *gitGrepLiteral(const char *pattern, size_t *length, bool *pure)
+{
+  StringInfoData run;
+  char *best = NULL;
+  size_t best_len = 0;
+  const char *p = pattern;
+
+  *pure = true;
+  *length = 0;
+
+  /* Nothing is required of both sides of an alternation */
+  if (strchr(pattern, '|') != NULL)
+  {
+    *pure = false;
+    return NULL;
+  }
+
+  initStringInfo(&run);
+  for (;;)
+  {
+    char c = *p;
+    bool literal = false;
+    char value = c;
+
+    if (c == '\\' && p[1] != '\0' && !isalnum((unsigned char)p[1]))
+    {
+      value = p[1];
+      p += 2;
+      literal = true;
+    }
+    else if (c != '\0' && strchr("\\.[]()*+?{}^$", c) == NULL)
+    {
+      p++;
+      literal = true;
+    }
+
+    /* `a*`, `a?` and `a{0,2}` don't require the `a` */
+    if (literal && *p != '*' && *p != '?' && *p != '{')
+    {
+      appendStringInfoChar(&run, value);
+      continue;
+    }
+
+    if (run.len > (int)best_len)
+    {
+      best = pnstrdup(run.data, run.len);
+      best_len = run.len;
+    }
+    resetStringInfo(&run);
+
+    if (c == '\0')
+      break;
+
+    *pure = false;
+    if (literal)
+      continue;
+
+    if (c == '[')
+      p = gitGrepSkipBracket(p);
+    else if (c == '{')
+    {
+      while (*p != '\0' && *p != '}')
+        p++;
+      if (*p != '\0')
+        p++;
+    }
+    else if (c == '(')
+    {
+      int depth = 0;
+
+      /* Groups may be optional, skip them whole */
+      do
+      {
+        if (*p == '\\' && p[1] != '\0')
+          p++;
+        else if (*p == '[')
+        {
+          p = gitGrepSkipBracket(p);
+          continue;
+        }
+        else if (*p == '(')
+          depth++;
+        else if (*p == ')')
+          depth--;
+        p++;
+      } while (*p != '\0' && depth > 0);
+    }
+    else if (c == '\\')
+      p += p[1] != '\0' ? 2 : 1;
+    else
+      p++;
+  }
+
+  pfree(run.data);
+  *length = best_len;
+  return best;
+}
+
+/* Past the bracket expression starting at p */
+static const char *gitGrepSkipBracket(const char *p)
+{
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+
+  while (*p != '\0' && *p != ']')
+  {
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+    {
+      char close = p[1];
+
+      p += 2;
+      while (*p != '\0' && !(p[0] == close && p[1] == ']'))
+        p++;
+      if (*p != '\0')
+        p++;
+    }
+    if (*p != '\0')
+      p++;
+  }
+
+  return *p != '\0' ? p + 1 : p;
+}
+
+/*
+ * Search the tree of commit: list the blobs under the path prefix, the
+ * search itself happens batch by batch in gitGrepNext().
+ */
+void gitGrepStart(GitFdwGrep *grep, const git_oid *commit_oid)
+{
+  git_commit *commit;
+  git_oid tree_oid;
+
+  if (git_commit_lookup(&commit, grep->repo, commit_oid) != GIT_OK)
+  {
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed to lookup commit %s", git_oid_tostr_s(commit_oid))));
+  }
+
+  tree_oid = *git_commit_tree_id(commit);
+  git_commit_free(commit);
+
+  gitGrepListTree(grep, &tree_oid, "");
+
+  grep->batch_start = grep->batch_end = grep->blob = 0;
+}
+
+/*
+ * Adds the blobs of a tree under the path prefix, descending into each
+ * subtree where it's found so that paths come out in the tree's order, the
+ * order `git grep` uses.
+ */
+static void gitGrepListTree(GitFdwGrep *grep, const git_oid *oid, const char *path)
+{
+  git_tree *tree;
+  size_t count, i;
+
+  check_stack_depth();
+
+  if (git_tree_lookup(&tree, grep->repo, oid) != GIT_OK)
+  {
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("Failed to lookup tree %s", path)));
+  }
+  grep->trees = lappend(grep->trees, tree);
+
+  count = git_tree_entrycount(tree);
+  for (i = 0; i < count; i++)
+  {
+    const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+    char *entry_path = psprintf("%s%s", path, git_tree_entry_name(entry));
+
+    CHECK_FOR_INTERRUPTS();
+
+    switch (git_tree_entry_filemode(entry))
+    {
+    case GIT_FILEMODE_TREE:
+      entry_path = psprintf("%s/", entry_path);
+      if (gitGrepUnderPrefix(grep->path_prefix, entry_path, true))
+        gitGrepListTree(grep, git_tree_entry_id(entry), entry_path);
+      break;
+    case GIT_FILEMODE_BLOB:
+    case GIT_FILEMODE_BLOB_EXECUTABLE:
+      if (gitGrepUnderPrefix(grep->path_prefix, entry_path, false))
+        gitGrepAddBlob(grep, git_tree_entry_id(entry), entry_path);
+      break;
+    default:
+      /* Symbolic links and submodules have nothing to search */
+      break;
+    }
+  }
+
+  grep->trees = list_truncate(grep->trees, list_length(grep->trees) - 1);
+  git_tree_free(tree);
+}
+
+/* Whether path, or for a directory something under it, starts with prefix */
+static bool gitGrepUnderPrefix(const char *prefix, const char *path, bool directory)
+{
+  size_t prefix_len, path_len;
+
+  if (prefix == NULL)
+    return true;
+
+  prefix_len = strlen(prefix);
+  path_len = strlen(path);
+
+  if (directory && path_len < prefix_len)
+    return strncmp(path, prefix, path_len) == 0;
+
+  return strncmp(path, prefix, prefix_len) == 0;
+}
+
+static void gitGrepAddBlob(GitFdwGrep *grep, const git_oid *oid, const char *path)
+{
+  GitFdwGrepSeen *seen;
+  bool found;
+
+  seen = (GitFdwGrepSeen *)hash_search(grep->seen, oid, HASH_ENTER, &found);
+  if (found)
+  {
+    grep->counters.duplicates_skipped++;
+    grep->blobs[seen->blob].paths = lappend(grep->blobs[seen->blob].paths, (void *)path);
+    return;
+  }
+
+  if (grep->nblobs == grep->blobs_size)
+  {
+    grep->blobs_size *= 2;
+    grep->blobs = (GitFdwGrepBlob *)repalloc(grep->blobs, sizeof(GitFdwGrepBlob) * grep->blobs_size);
+  }
+
+  seen->blob = grep->nblobs++;
+  memset(&grep->blobs[seen->blob], 0, sizeof(GitFdwGrepBlob));
+  grep->blobs[seen->blob].oid = *oid;
+  grep->blobs[seen->blob].paths = list_make1((void *)path);
+}
+
+/*
+ * Next matching line, for each path its blob is found at. The pointers
+ * stay valid until the next call.
+ */
+bool gitGrepNext(GitFdwGrep *grep, const char **path, int *line_no, const char **line, int *length)
+{
+  for (;;)
+  {
+    GitFdwGrepBlob *blob;
+
+    if (grep->blob >= grep->batch_end && !gitGrepNextBatch(grep))
+      return false;
+
+    blob = &grep->blobs[grep->blob];
+    if (grep->offset < blob->matches_len)
+    {
+      int32 header[2];
+
+      memcpy(header, blob->matches + grep->offset, sizeof(header));
+      *path = (const char *)list_nth(blob->paths, grep->path_index);
+      *line_no = header[0];
+      *length = header[1];
+      *line = blob->matches + grep->offset + sizeof(header);
+      grep->offset += sizeof(header) + header[1];
+      return true;
+    }
+
+    /* Same lines again for the next path of the blob */
+    grep->offset = 0;
+    if (++grep->path_index < list_length(blob->paths))
+      continue;
+
+    grep->path_index = 0;
+    free(blob->matches);
+    blob->matches = NULL;
+    blob->matches_len = blob->matches_size = 0;
+    grep->blob++;
+  }
+}
+
+/* Search the next batch of blobs, false once they all have been */
+static bool gitGrepNextBatch(GitFdwGrep *grep)
+{
+  GitFdwGrepWorker workers[GREP_MAX_WORKERS];
+  sigset_t blocked, previous;
+  int nworkers, started = 0;
+  int i;
+
+  if (grep->batch_end >= grep->nblobs)
+    return false;
+
+  grep->batch_start = grep->batch_end;
+  grep->batch_end = Min(grep->nblobs, grep->batch_start + GREP_BATCH_BLOBS);
+  grep->blob = grep->batch_start;
+  grep->path_index = 0;
+  grep->offset = 0;
+
+  pg_atomic_write_u32(&grep->next_blob, grep->batch_start);
+  pg_atomic_write_u32(&grep->cancel, 0);
+
+  /* Besides the backend, with a repository handle each */
+  nworkers = Min(git_fdw_grep_workers - 1, grep->batch_end - grep->batch_start - 1);
+  for (i = 0; i < nworkers; i++)
+  {
+    if (grep->worker_repos[i] == NULL &&
+        git_repository_open(&grep->worker_repos[i], grep->path) != GIT_OK)
+    {
+      grep->worker_repos[i] = NULL;
+      break;
+    }
+  }
+  nworkers = i;
+
+  /* Signals are for the backend's thread to handle */
+  sigfillset(&blocked);
+  pthread_sigmask(SIG_SETMASK, &blocked, &previous);
+  for (i = 0; i < nworkers; i++)
+  {
+    memset(&workers[i], 0, sizeof(GitFdwGrepWorker));
+    workers[i].grep = grep;
+    workers[i].repo = grep->worker_repos[i];
+    if (pthread_create(&workers[i].thread, NULL, gitGrepWorkerMain, &workers[i]) != 0)
+      break;
+    started++;
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  PG_TRY();
+  {
+    gitGrepWork(grep, grep->repo, grep->has_regex ? &grep->regex : NULL, &grep->counters, true);
+  }
+  PG_CATCH();
+  {
+    pg_atomic_write_u32(&grep->cancel, 1);
+    for (i = 0; i < started; i++)
+      pthread_join(workers[i].thread, NULL);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  for (i = 0; i < started; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    grep->counters.blobs_searched += workers[i].counters.blobs_searched;
+    grep->counters.bytes_searched += workers[i].counters.bytes_searched;
+    grep->counters.binary_skipped += workers[i].counters.binary_skipped;
+  }
+
+  gitAllocatorCheckLimit();
+  for (i = grep->batch_start; i < grep->batch_end; i++)
+  {
+    if (grep->blobs[i].failed)
+      ereport(ERROR,
+              (errcode(ERRCODE_FDW_ERROR),
+               errmsg("Failed to search blob %s at %s",
+                      git_oid_tostr_s(&grep->blobs[i].oid),
+                      (char *)linitial(grep->blobs[i].paths))));
+  }
+
+  return true;
+}
+
+/*
+ * Take blobs of the batch until there are none left. Only the backend's
+ * thread may touch anything PostgreSQL.
+ */
+static void gitGrepWork(GitFdwGrep *grep, git_repository *repo, regex_t *regex,
+                        GitFdwGrepCounters *counters, bool backend)
+{
+  for (;;)
+  {
+    uint32 blob;
+
+    if (backend)
+      CHECK_FOR_INTERRUPTS();
+    if (pg_atomic_read_u32(&grep->cancel) != 0)
+      break;
+
+    blob = pg_atomic_fetch_add_u32(&grep->next_blob, 1);
+    if (blob >= (uint32)grep->batch_end)
+      break;
+
+    gitGrepSearchBlob(grep, repo, regex, &grep->blobs[blob], counters);
+  }
+}
+
+static void *gitGrepWorkerMain(void *arg)
+{
+  GitFdwGrepWorker *worker = (GitFdwGrepWorker *)arg;
+  GitFdwGrep *grep = worker->grep;
+  regex_t regex;
+
+  /* glibc serializes matches on a shared regex_t */
+  if (grep->has_regex && regcomp(&regex, grep->pattern, GREP_REGEX_FLAGS) != 0)
+    return NULL;
+
+  gitGrepWork(grep, worker->repo, grep->has_regex ? &regex : NULL, &worker->counters, false);
+
+  if (grep->has_regex)
+    regfree(&regex);
+  return NULL;
+}
+
+static void gitGrepSearchBlob(GitFdwGrep *grep, git_repository *repo, regex_t *regex,
+                              GitFdwGrepBlob *blob, GitFdwGrepCounters *counters)
+{
+  git_blob *object;
+  const char *cursor, *end;
+  int line_no = 1;
+#ifndef REG_STARTEND
+  char *copy = NULL;
+  size_t copy_size = 0;
+#endif
+
+  if (git_blob_lookup(&object, repo, &blob->oid) != GIT_OK)
+  {
+    blob->failed = true;
+    return;
+  }
+
+  if (git_blob_is_binary(object))
+  {
+    counters->binary_skipped++;
+    git_blob_free(object);
+    return;
+  }
+
+  cursor = (const char *)git_blob_rawcontent(object);
+  end = cursor + git_blob_rawsize(object);
+  counters->blobs_searched++;
+  counters->bytes_searched += end - cursor;
+
+  while (cursor < end)
+  {
+    const char *line = cursor;
+    const char *line_end;
+    bool matches = true;
+
+    /* Jump to the next line with the literal, counting the ones skipped */
+    if (grep->literal != NULL)
+    {
+      const char *hit = gitFindLiteral(cursor, end - cursor, grep->literal, grep->literal_len);
+      const char *newline;
+
+      if (hit == NULL)
+        break;
+      while ((newline = memchr(line, '\n', hit - line)) != NULL)
+      {
+        line = newline + 1;
+        line_no++;
+      }
+    }
+
+    line_end = memchr(line, '\n', end - line);
+    if (line_end == NULL)
+      line_end = end;
+
+    if (!grep->pure_literal)
+    {
+#ifdef REG_STARTEND
+      regmatch_t bounds;
+
+      bounds.rm_so = 0;
+      bounds.rm_eo = line_end - line;
+      matches = regexec(regex, line, 1, &bounds, REG_STARTEND) == 0;
+#else
+      if ((size_t)(line_end - line) >= copy_size)
+      {
+        char *grown = realloc(copy, (line_end - line) + 1);
+
+        if (grown == NULL)
+        {
+          blob->failed = true;
+          break;
+        }
+        copy = grown;
+        copy_size = (line_end - line) + 1;
+      }
+      memcpy(copy, line, line_end - line);
+      copy[line_end - line] = '\0';
+      matches = regexec(regex, copy, 0, NULL, 0) == 0;
+#endif
+    }
+
+    if (matches && !gitGrepAppend(blob, line_no, line, line_end - line))
+    {
+      blob->failed = true;
+      break;
+    }
+
+    cursor = line_end < end ? line_end + 1 : end;
+    line_no++;
+  }
+
+#ifndef REG_STARTEND
+  free(copy);
+#endif
+  git_blob_free(object);
+}
+
+/* Runs on any thread, hence malloc */
+static bool gitGrepAppend(GitFdwGrepBlob *blob, int line_no, const char *line, size_t length)
+{
+  int32 header[2];
+  size_t needed = blob->matches_len + sizeof(header) + length;
+
+  if (length > INT_MAX)
+    return false;
+
+  if (needed > blob->matches_size)
+  {
+    size_t size = Max(Max(needed, blob->matches_size * 2), 1024);
+    char *grown = realloc(blob->matches, size);
+
+    if (grown == NULL)
+      return false;
+    blob->matches = grown;
+    blob->matches_size = size;
+  }
+
+  header[0] = line_no;
+  header[1] = (int32)length;
+  memcpy(blob->matches + blob->matches_len, header, sizeof(header));
+  memcpy(blob->matches + blob->matches_len + sizeof(header), line, length);
+  blob->matches_len = needed;
+  return true;
+}
+
+const GitFdwGrepCounters *gitGrepCounters(GitFdwGrep *grep)
+{
+  return &grep->counters;
+}
+
+void gitGrepEnd(GitFdwGrep *grep)
+{
+  ListCell *lc;
+  int i;
+
+  for (i = 0; i < GREP_MAX_WORKERS; i++)
+  {
+    git_repository_free(grep->worker_repos[i]);
+    grep->worker_repos[i] = NULL;
+  }
+
+  for (i = 0; i < grep->nblobs; i++)
+  {
+    free(grep->blobs[i].matches);
+    grep->blobs[i].matches = NULL;
+  }
+
+  foreach (lc, grep->trees)
+    git_tree_free((git_tree *)lfirst(lc));
+  list_free(grep->trees);
+  grep->trees = NIL;
+
+  if (grep->has_regex)
+    regfree(&grep->regex);
+  grep->has_regex = false;
+}
+
+/*
+ * Compares the needle's first and last bytes against 16 positions at once
+ * and only memcmp()s where both match, which on source code is rare.
+ * Elsewhere memchr() on the first byte does the skipping.
+ */
+const char *gitFindLiteral(const char *haystack, size_t length, const char *needle, size_t needle_length)
+{
+  const char *p = haystack;
+  const char *last;
+
+  if (needle_length == 0)
+    return haystack;
+  if (needle_length > length)
+    return NULL;
+  if (needle_length == 1)
+    return memchr(haystack, needle[0], length);
+
+  /* Last position a match can start at */
+  last = haystack + length - needle_length;
+
+#ifdef __SSE2__
+  {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i final = _mm_set1_epi8(needle[needle_length - 1]);
+
+    for (; p + 16 <= last + 1; p += 16)
+    {
+      __m128i block_first = _mm_loadu_si128((const __m128i *)p);
+      __m128i block_final = _mm_loadu_si128((const __m128i *)(p + needle_length - 1));
+      unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                          _mm_cmpeq_epi8(final, block_final)));
+
+      while (mask != 0)
+      {
+        int bit = __builtin_ctz(mask);
+
+        if (memcmp(p + bit + 1, needle + 1, needle_length - 2) == 0)
+          return p + bit;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+
+  while (p <= last)
+  {
+    p = memchr(p, needle[0], last - p + 1);
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p + 1, needle + 1, needle_length - 1) == 0)
+      return p;
+    p++;
+  }
+
+  return NULL;
+}
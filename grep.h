@@ -0,0 +1,29 @@
+/*
+ * Content search over the blobs of a commit's tree, like `git grep -E`.
+ *
+ * Blobs are searched in batches by up to git_fdw.grep_workers threads, the
+ * backend's own included, and the matches of a batch are returned before
+ * the next one gets searched. A blob found at several paths is searched
+ * once, binary blobs are skipped.
+ */
+typedef struct GitFdwGrep GitFdwGrep;
+
+/* What a search went through, for EXPLAIN ANALYZE */
+typedef struct GitFdwGrepCounters
+{
+  int64 blobs_searched;
+  int64 bytes_searched;
+  int64 binary_skipped;
+  int64 duplicates_skipped;
+} GitFdwGrepCounters;
+
+void gitGrepInit(void);
+GitFdwGrep *gitGrepBegin(git_repository *repo, const char *path, const char *pattern, const char *path_prefix);
+void gitGrepStart(GitFdwGrep *grep, const git_oid *commit);
+void gitGrepRewind(GitFdwGrep *grep);
+bool gitGrepNext(GitFdwGrep *grep, const char **path, int *line_no, const char **line, int *length);
+const GitFdwGrepCounters *gitGrepCounters(GitFdwGrep *grep);
+void gitGrepEnd(GitFdwGrep *grep);
+
+/* First occurrence of needle in haystack, NULL if none */
+const char *gitFindLiteral(const char *haystack, size_t length, const char *needle, size_t needle_length);
@@ -8,5 +8,10 @@ static const struct GitFdwOption valid_options[] = {
 	{"path",   ForeignTableRelationId},
 	{"branch", ForeignTableRelationId},
 	{"git_search_path", ForeignTableRelationId},
+	{"mailmap", ForeignTableRelationId},
+	{"kind", ForeignTableRelationId},
+	{"oldest_commit", ForeignTableRelationId},
+	{"async_capable", ForeignServerRelationId},
+	{"async_capable", ForeignTableRelationId},
 	{NULL,     InvalidOid}
 };
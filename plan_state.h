@@ -1,9 +1,40 @@
+/* How much of each commit the scan has to decode */
+typedef enum GitFdwFetch
+{
+	GIT_FETCH_OID,				/* nothing beyond the sha1 */
+	GIT_FETCH_COMMIT,			/* the commit object */
+	GIT_FETCH_DIFF				/* the commit and its diff against the first parent */
+} GitFdwFetch;
+
+/* What a foreign table returns, from its kind option */
+typedef enum GitFdwTableKind
+{
+	GIT_TABLE_COMMITS,			/* a row per commit of the branch */
+	GIT_TABLE_GREP,				/* the lines of a commit's files matching a pattern */
+	GIT_TABLE_BLAME				/* the lines of a file, with the commit each comes from */
+} GitFdwTableKind;
+
 typedef struct GitFdwPlanState
 {
 	char	   *path;
 	char	   *branch;
 	char	   *git_search_path;
+	bool		mailmap;
+	GitFdwTableKind kind;
+	char	   *oldest_commit;	/* blame tables' history window */
+	bool		async_capable;	/* from the server, unless the table says otherwise */
 	List	   *options;
 	BlockNumber pages;
 	double	    ntuples;
 } GitFdwPlanState;
+
+/* An aggregation computed by the scan itself, planned on the upper rel */
+typedef struct GitFdwUpperPlanState
+{
+	Oid			foreigntableid;
+	List	   *quals;			/* base restriction clauses, evaluated in the scan */
+	List	   *tlist;			/* group keys and aggregates, in output order */
+	char	   *group_keys;		/* '1' where the tlist entry is a group key */
+	List	   *pushdowns;		/* as for plain scans */
+	GitFdwFetch fetch;
+} GitFdwUpperPlanState;
@@ -0,0 +1,739 @@
+#include "postgres.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <git2.h>
+
+#include "nodes/execnodes.h"
+#include "nodes/pg_list.h"
+#include "portability/instr_time.h"
+#include "utils/hsearch.h"
+#include "allocator.h"
+#include "plan_state.h"
+#include "execution_state.h"
+#include "prefetch.h"
+#include "filter.h"
+
+/* How to Get diff of the first commit?
+ * see https://stackoverflow.com/questions/40883798/how-to-get-git-diff-of-the-first-commit
+ */
+
+#define EMPTY_REPO_SHA1 "4b825dc642cb6eb9a060e54bf8d69288fbee4904"
+
+/* How far ahead of the backend the thread may get */
+#define PREFETCH_QUEUE_ROWS 1024
+
+#define PREFETCH_START(prefetch, start) \
+  do                                    \
+  {                                     \
+    if ((prefetch)->timing)             \
+      INSTR_TIME_SET_CURRENT(start);    \
+  } while (0)
+
+#define PREFETCH_END(prefetch, start, total)     \
+  do                                             \
+  {                                              \
+    if ((prefetch)->timing)                      \
+    {                                            \
+      instr_time end;                            \
+      INSTR_TIME_SET_CURRENT(end);               \
+      INSTR_TIME_ACCUM_DIFF(total, end, start);  \
+    }                                            \
+  } while (0)
+
+/* A row and its strings, in a single malloc'd block */
+typedef struct GitFdwPrefetchedRow
+{
+  struct GitFdwPrefetchedRow *next;
+  int64 walked; /* commits walked up to this one */
+  GitFdwCommitRow row;
+} GitFdwPrefetchedRow;
+
+struct GitFdwPrefetch
+{
+  /* Set before the thread starts, read-only afterwards */
+  char *path;
+  git_oid tip;
+  git_oid point;
+  bool has_point; /* return point alone instead of walking from tip */
+  bool mailmap;
+  GitFdwFetch fetch;
+  char **author_emails;
+  int nauthor_emails;
+  char **message_literals; /* the lowercase ones last */
+  int nmessage_literals;
+  int nmessage_literals_cs; /* how many are searched as they are */
+  bool timing;
+
+  pthread_t thread;
+  bool started;
+  int pipe[2]; /* written to when rows or the end of the walk show up */
+
+  pthread_mutex_t lock; /* protects everything below */
+  pthread_cond_t room;  /* signalled when the backend takes a row */
+  GitFdwPrefetchedRow *head;
+  GitFdwPrefetchedRow *tail;
+  int nrows;
+  bool finished;
+  bool cancel;
+  char error[256]; /* empty unless the walk failed */
+  GitFdwPrefetchCounters counters;
+
+  /* The row the backend is on, freed when it takes the next one */
+  GitFdwPrefetchedRow *current;
+};
+
+static void *gitPrefetchMain(void *arg);
+static bool gitPrefetchPassesFilters(GitFdwPrefetch *prefetch, git_odb *odb, void *mailmap,
+                                     const git_oid *oid, GitFdwPrefetchCounters *counters);
+static GitFdwPrefetchedRow *gitPrefetchCopy(const git_oid *oid, git_commit *commit,
+                                            size_t insertions, size_t deletions, size_t files_changed);
+static bool gitPrefetchPush(GitFdwPrefetch *prefetch, GitFdwPrefetchedRow *row,
+                            const GitFdwPrefetchCounters *counters);
+static void gitPrefetchNotify(GitFdwPrefetch *prefetch);
+static void gitPrefetchDrain(GitFdwPrefetch *prefetch);
+static void gitTrimIdentity(const char **start, size_t *length);
+
+/*
+ * Starts walking from tip, or returns point alone when it isn't NULL (the
+ * caller checked the branch reaches it). Everything is copied: the thread
+ * only reads memory the returned struct holds. counters are added to.
+ */
+GitFdwPrefetch *gitPrefetchBegin(const char *path,
+                                 const git_oid *tip,
+                                 const git_oid *point,
+                                 bool mailmap,
+                                 GitFdwFetch fetch,
+                                 List *author_emails,
+                                 List *message_literals,
+                                 List *message_literals_ci,
+                                 bool timing,
+                                 const GitFdwPrefetchCounters *counters)
+{
+  GitFdwPrefetch *prefetch = (GitFdwPrefetch *)palloc0(sizeof(GitFdwPrefetch));
+  sigset_t blocked, previous;
+  ListCell *lc;
+  int failed;
+
+  prefetch->path = pstrdup(path);
+  prefetch->tip = *tip;
+  if (point != NULL)
+  {
+    prefetch->point = *point;
+    prefetch->has_point = true;
+  }
+  prefetch->mailmap = mailmap;
+  prefetch->fetch = fetch;
+  prefetch->timing = timing;
+  prefetch->counters = *counters;
+
+  prefetch->author_emails = (char **)palloc(sizeof(char *) * Max(list_length(author_emails), 1));
+  foreach (lc, author_emails)
+    prefetch->author_emails[prefetch->nauthor_emails++] = pstrdup(strVal(lfirst(lc)));
+
+  prefetch->message_literals = (char **)palloc(sizeof(char *) *
+                                               Max(list_length(message_literals) +
+                                                       list_length(message_literals_ci),
+                                                   1));
+  foreach (lc, message_literals)
+    prefetch->message_literals[prefetch->nmessage_literals++] = pstrdup(strVal(lfirst(lc)));
+  prefetch->nmessage_literals_cs = prefetch->nmessage_literals;
+  foreach (lc, message_literals_ci)
+    prefetch->message_literals[prefetch->nmessage_literals++] = pstrdup(strVal(lfirst(lc)));
+
+  if (pipe(prefetch->pipe) != 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("could not create pipe for git_fdw: %m")));
+
+  /* Neither side ever waits on the pipe itself */
+  if (fcntl(prefetch->pipe[0], F_SETFL, O_NONBLOCK) != 0 ||
+      fcntl(prefetch->pipe[1], F_SETFL, O_NONBLOCK) != 0)
+  {
+    int save_errno = errno;
+
+    close(prefetch->pipe[0]);
+    close(prefetch->pipe[1]);
+    errno = save_errno;
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("could not set git_fdw pipe to non-blocking mode: %m")));
+  }
+
+  pthread_mutex_init(&prefetch->lock, NULL);
+  pthread_cond_init(&prefetch->room, NULL);
+
+  /* Signals are for the backend's thread to handle */
+  sigfillset(&blocked);
+  pthread_sigmask(SIG_SETMASK, &blocked, &previous);
+  failed = pthread_create(&prefetch->thread, NULL, gitPrefetchMain, prefetch);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (failed != 0)
+  {
+    close(prefetch->pipe[0]);
+    close(prefetch->pipe[1]);
+    pthread_cond_destroy(&prefetch->room);
+    pthread_mutex_destroy(&prefetch->lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("could not start a thread walking %s", path),
+             errdetail("pthread_create returned %d.", failed)));
+  }
+  prefetch->started = true;
+
+  return prefetch;
+}
+
+/* Readable when gitPrefetchReady() may have changed its mind */
+pgsocket gitPrefetchSocket(GitFdwPrefetch *prefetch)
+{
+  return prefetch->pipe[0];
+}
+
+/* Whether gitPrefetchNext() has a row, or the end of the walk, to return */
+bool gitPrefetchReady(GitFdwPrefetch *prefetch)
+{
+  bool ready;
+
+  gitPrefetchDrain(prefetch);
+
+  pthread_mutex_lock(&prefetch->lock);
+  ready = prefetch->head != NULL || prefetch->finished;
+  pthread_mutex_unlock(&prefetch->lock);
+
+  return ready;
+}
+
+/*
+ * Takes the next row, valid until the next call. Returns NULL when none is
+ * ready yet, and sets *done once the walk is over. A failed walk errors out
+ * once the rows before the failure are taken.
+ */
+const GitFdwCommitRow *gitPrefetchNext(GitFdwPrefetch *prefetch, int64 *walked, bool *done)
+{
+  GitFdwPrefetchedRow *row;
+  bool finished;
+  char error[sizeof(prefetch->error)];
+
+  free(prefetch->current);
+  prefetch->current = NULL;
+
+  /* Before looking, so that a row pushed from now on leaves a byte behind */
+  gitPrefetchDrain(prefetch);
+
+  pthread_mutex_lock(&prefetch->lock);
+  row = prefetch->head;
+  if (row != NULL)
+  {
+    if (prefetch->nrows-- == PREFETCH_QUEUE_ROWS)
+      pthread_cond_signal(&prefetch->room);
+    prefetch->head = row->next;
+    if (prefetch->head == NULL)
+      prefetch->tail = NULL;
+  }
+  finished = prefetch->finished;
+  strlcpy(error, prefetch->error, sizeof(error));
+  pthread_mutex_unlock(&prefetch->lock);
+
+  *done = row == NULL && finished;
+  if (*done && error[0] != '\0')
+  {
+    gitAllocatorCheckLimit();
+    ereport(ERROR,
+            (errcode(ERRCODE_FDW_ERROR),
+             errmsg("%s", error)));
+  }
+
+  if (row == NULL)
+    return NULL;
+
+  prefetch->current = row;
+  *walked = row->walked;
+  return &row->row;
+}
+
+void gitPrefetchCounters(GitFdwPrefetch *prefetch, GitFdwPrefetchCounters *counters)
+{
+  pthread_mutex_lock(&prefetch->lock);
+  *counters = prefetch->counters;
+  pthread_mutex_unlock(&prefetch->lock);
+}
+
+/* Stops the thread, wherever it is, and frees what it left */
+void gitPrefetchEnd(GitFdwPrefetch *prefetch)
+{
+  GitFdwPrefetchedRow *row;
+
+  if (!prefetch->started)
+    return;
+
+  pthread_mutex_lock(&prefetch->lock);
+  prefetch->cancel = true;
+  pthread_cond_broadcast(&prefetch->room);
+  pthread_mutex_unlock(&prefetch->lock);
+
+  pthread_join(prefetch->thread, NULL);
+  prefetch->started = false;
+
+  while ((row = prefetch->head) != NULL)
+  {
+    prefetch->head = row->next;
+    free(row);
+  }
+  prefetch->tail = NULL;
+  prefetch->nrows = 0;
+  free(prefetch->current);
+  prefetch->current = NULL;
+
+  close(prefetch->pipe[0]);
+  close(prefetch->pipe[1]);
+  pthread_cond_destroy(&prefetch->room);
+  pthread_mutex_destroy(&prefetch->lock);
+}
+
+static void *gitPrefetchMain(void *arg)
+{
+  GitFdwPrefetch *prefetch = (GitFdwPrefetch *)arg;
+  GitFdwPrefetchCounters counters;
+  git_repository *repo = NULL;
+  git_odb *odb = NULL;
+  git_revwalk *walker = NULL;
+#ifdef HAVE_GIT_MAILMAP
+  git_mailmap *mailmap = NULL;
+#endif
+  void *filter_mailmap = NULL;
+  bool point_pending = prefetch->has_point;
+  char error[sizeof(prefetch->error)];
+
+  counters = prefetch->counters;
+  error[0] = '\0';
+
+  if (git_repository_open(&repo, prefetch->path) != GIT_OK ||
+      git_repository_odb(&odb, repo) != GIT_OK)
+    snprintf(error, sizeof(error), "Failed opening repository: '%s'", prefetch->path);
+  else if (!prefetch->has_point &&
+           (git_revwalk_new(&walker, repo) != GIT_OK ||
+            git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL) != GIT_OK ||
+            git_revwalk_push(walker, &prefetch->tip) != GIT_OK))
+    snprintf(error, sizeof(error), "Failed to walk the history of '%s'", prefetch->path);
+
+#ifdef HAVE_GIT_MAILMAP
+  /* A repository without a .mailmap simply resolves nothing */
+  if (error[0] == '\0' && prefetch->mailmap &&
+      git_mailmap_from_repository(&mailmap, repo) == GIT_OK)
+    filter_mailmap = mailmap;
+#endif
+
+  while (error[0] == '\0')
+  {
+    GitFdwPrefetchedRow *row;
+    git_commit *commit = NULL;
+    git_oid oid;
+    size_t insertions = 0, deletions = 0, files_changed = 0;
+    instr_time start;
+    bool walked;
+
+    PREFETCH_START(prefetch, start);
+    if (prefetch->has_point)
+    {
+      walked = point_pending;
+      oid = prefetch->point;
+      point_pending = false;
+    }
+    else
+      walked = git_revwalk_next(&oid, walker) == GIT_OK;
+    PREFETCH_END(prefetch, start, counters.revwalk);
+
+    if (!walked)
+      break;
+    counters.commits_walked++;
+
+    PREFETCH_START(prefetch, start);
+    if (!gitPrefetchPassesFilters(prefetch, odb, filter_mailmap, &oid, &counters))
+    {
+      PREFETCH_END(prefetch, start, counters.commit_decode);
+      counters.commits_filtered++;
+
+      /* Cancellation is otherwise noticed when pushing */
+      if (counters.commits_filtered % 1024 == 0)
+      {
+        pthread_mutex_lock(&prefetch->lock);
+        walked = !prefetch->cancel;
+        prefetch->counters = counters;
+        pthread_mutex_unlock(&prefetch->lock);
+        if (!walked)
+          break;
+      }
+      continue;
+    }
+
+    if (prefetch->fetch >= GIT_FETCH_COMMIT)
+    {
+      if (git_commit_lookup(&commit, repo, &oid) != GIT_OK)
+      {
+        snprintf(error, sizeof(error), "Failed to lookup the next object");
+        break;
+      }
+      counters.objects_looked_up++;
+      counters.commit_bytes += strlen(git_commit_raw_header(commit)) +
+                               strlen(git_commit_message_raw(commit));
+    }
+    PREFETCH_END(prefetch, start, counters.commit_decode);
+
+    if (prefetch->fetch >= GIT_FETCH_DIFF)
+    {
+      PREFETCH_START(prefetch, start);
+      gitDiffCounts(repo, commit, &insertions, &deletions, &files_changed,
+                    &counters.objects_looked_up, &counters.trees_diffed);
+      PREFETCH_END(prefetch, start, counters.diff);
+    }
+
+    row = gitPrefetchCopy(&oid, commit, insertions, deletions, files_changed);
+    git_commit_free(commit);
+    if (row == NULL)
+    {
+      snprintf(error, sizeof(error), "out of memory");
+      break;
+    }
+    row->walked = counters.commits_walked;
+
+    if (!gitPrefetchPush(prefetch, row, &counters))
+      break;
+  }
+
+#ifdef HAVE_GIT_MAILMAP
+  git_mailmap_free(mailmap);
+#endif
+  git_revwalk_free(walker);
+  git_odb_free(odb);
+  git_repository_free(repo);
+
+  pthread_mutex_lock(&prefetch->lock);
+  prefetch->finished = true;
+  strlcpy(prefetch->error, error, sizeof(prefetch->error));
+  prefetch->counters = counters;
+  pthread_mutex_unlock(&prefetch->lock);
+  gitPrefetchNotify(prefetch);
+
+  return NULL;
+}
+
+/* gitCommitPassesFilters() for the thread, which can't intern identities */
+static bool gitPrefetchPassesFilters(GitFdwPrefetch *prefetch, git_odb *odb, void *mailmap,
+                                     const git_oid *oid, GitFdwPrefetchCounters *counters)
+{
+  git_odb_object *raw;
+  const char *data, *name, *email, *message;
+  size_t size, name_length, email_length, message_length;
+  char *author_name = NULL, *author_email = NULL;
+  const char *resolved_email;
+  bool passes = true;
+  int i;
+
+  if (prefetch->nauthor_emails == 0 && prefetch->nmessage_literals == 0)
+    return true;
+
+  /* Let the regular lookup report unreadable objects */
+  if (git_odb_read(&raw, odb, oid) != GIT_OK)
+    return true;
+  counters->objects_looked_up++;
+
+  data = (const char *)git_odb_object_data(raw);
+  size = git_odb_object_size(raw);
+
+  if (gitRawCommitMessage(data, size, &message, &message_length))
+  {
+    for (i = 0; i < prefetch->nmessage_literals && passes; i++)
+      passes = gitFindMessageLiteral(message, message_length,
+                              prefetch->message_literals[i], strlen(prefetch->message_literals[i]),
+                              i >= prefetch->nmessage_literals_cs);
+  }
+
+  if (!passes || prefetch->nauthor_emails == 0)
+  {
+    git_odb_object_free(raw);
+    return passes;
+  }
+
+  if (gitRawCommitAuthor(data, size, &name, &name_length, &email, &email_length))
+  {
+    author_name = strndup(name, name_length);
+    author_email = strndup(email, email_length);
+  }
+  git_odb_object_free(raw);
+
+  /* Unparseable header: don't guess, the executor will recheck */
+  if (author_name == NULL || author_email == NULL)
+  {
+    free(author_name);
+    free(author_email);
+    return true;
+  }
+
+  resolved_email = author_email;
+#ifdef HAVE_GIT_MAILMAP
+  if (mailmap != NULL)
+  {
+    const char *real_name, *real_email;
+
+    if (git_mailmap_resolve(&real_name, &real_email, (git_mailmap *)mailmap,
+                            author_name, author_email) == GIT_OK)
+      resolved_email = real_email;
+  }
+#endif
+
+  for (i = 0; i < prefetch->nauthor_emails && passes; i++)
+    passes = strcmp(resolved_email, prefetch->author_emails[i]) == 0;
+
+  free(author_name);
+  free(author_email);
+  return passes;
+}
+
+static GitFdwPrefetchedRow *gitPrefetchCopy(const git_oid *oid, git_commit *commit,
+                                            size_t insertions, size_t deletions, size_t files_changed)
+{
+  const char *strings[5] = {NULL, NULL, NULL, NULL, NULL};
+  size_t lengths[5] = {0, 0, 0, 0, 0};
+  const char **targets[5];
+  GitFdwPrefetchedRow *row;
+  size_t size = sizeof(GitFdwPrefetchedRow);
+  char *p;
+  int i;
+
+  if (commit != NULL)
+  {
+    const git_signature *committer = git_commit_committer(commit);
+    const git_signature *author = git_commit_author(commit);
+
+    strings[0] = git_commit_message(commit);
+    strings[1] = committer->name;
+    strings[2] = committer->email;
+    strings[3] = author->name;
+    strings[4] = author->email;
+  }
+
+  for (i = 0; i < 5; i++)
+  {
+    if (strings[i] != NULL)
+    {
+      lengths[i] = strlen(strings[i]) + 1;
+      size += lengths[i];
+    }
+  }
+
+  row = (GitFdwPrefetchedRow *)malloc(size);
+  if (row == NULL)
+    return NULL;
+  memset(row, 0, sizeof(GitFdwPrefetchedRow));
+
+  row->row.oid = *oid;
+  row->row.insertions = insertions;
+  row->row.deletions = deletions;
+  row->row.files_changed = files_changed;
+  if (commit != NULL)
+  {
+    row->row.commit_time = git_commit_committer(commit)->when.time;
+    row->row.author_time = git_commit_author(commit)->when.time;
+  }
+
+  targets[0] = &row->row.message;
+  targets[1] = &row->row.committer_name;
+  targets[2] = &row->row.committer_email;
+  targets[3] = &row->row.author_name;
+  targets[4] = &row->row.author_email;
+
+  p = (char *)(row + 1);
+  for (i = 0; i < 5; i++)
+  {
+    if (strings[i] == NULL)
+      continue;
+    memcpy(p, strings[i], lengths[i]);
+    *targets[i] = p;
+    p += lengths[i];
+  }
+
+  return row;
+}
+
+/* Queues row, waiting for room if needed. False if cancelled meanwhile. */
+static bool gitPrefetchPush(GitFdwPrefetch *prefetch, GitFdwPrefetchedRow *row,
+                            const GitFdwPrefetchCounters *counters)
+{
+  bool was_empty;
+
+  pthread_mutex_lock(&prefetch->lock);
+  while (prefetch->nrows >= PREFETCH_QUEUE_ROWS && !prefetch->cancel)
+    pthread_cond_wait(&prefetch->room, &prefetch->lock);
+
+  if (prefetch->cancel)
+  {
+    pthread_mutex_unlock(&prefetch->lock);
+    free(row);
+    return false;
+  }
+
+  was_empty = prefetch->head == NULL;
+  if (prefetch->tail != NULL)
+    prefetch->tail->next = row;
+  else
+    prefetch->head = row;
+  prefetch->tail = row;
+  prefetch->nrows++;
+  prefetch->counters = *counters;
+  pthread_mutex_unlock(&prefetch->lock);
+
+  /* The backend only waits when it found nothing */
+  if (was_empty)
+    gitPrefetchNotify(prefetch);
+  return true;
+}
+
+static void gitPrefetchNotify(GitFdwPrefetch *prefetch)
+{
+  char byte = 0;
+
+  /* A full pipe already has the backend's attention */
+  (void)write(prefetch->pipe[1], &byte, 1);
+}
+
+static void gitPrefetchDrain(GitFdwPrefetch *prefetch)
+{
+  char buffer[64];
+
+  while (read(prefetch->pipe[0], buffer, sizeof(buffer)) > 0)
+    ;
+}
+
+/*
+ * Lines added and removed by commit, and files touched, against its first
+ * parent (or nothing, for a root commit). False if the diff failed.
+ */
+bool gitDiffCounts(git_repository *repo, git_commit *commit,
+                   size_t *insertions, size_t *deletions, size_t *files_changed,
+                   int64 *objects_looked_up, int64 *trees_diffed)
+{
+  git_tree *commit_tree = NULL;
+  git_commit *commit_parent = NULL;
+  git_tree *commit_parent_tree = NULL;
+  git_diff *commit_diff = NULL;
+  git_diff_stats *commit_diff_stats = NULL;
+  bool counted = false;
+
+  if (git_commit_parent(&commit_parent, commit, 0) == GIT_OK)
+  {
+    (*objects_looked_up)++;
+    if (git_commit_tree(&commit_parent_tree, commit_parent) == GIT_OK)
+      (*objects_looked_up)++;
+  }
+  else
+  {
+    /* Get diff of the first commit. */
+    git_oid oid_tree_empty;
+
+    if (git_oid_fromstr(&oid_tree_empty, EMPTY_REPO_SHA1) == GIT_OK)
+    {
+      git_tree_lookup(&commit_parent_tree, repo, &oid_tree_empty);
+    }
+  }
+
+  if (git_commit_tree(&commit_tree, commit) == GIT_OK)
+  {
+    (*objects_looked_up)++;
+
+    if (git_diff_tree_to_tree(&commit_diff, repo, commit_parent_tree, commit_tree, NULL) == GIT_OK)
+    {
+      (*trees_diffed)++;
+
+      if (git_diff_get_stats(&commit_diff_stats, commit_diff) == GIT_OK)
+      {
+        *insertions = git_diff_stats_insertions(commit_diff_stats);
+        *deletions = git_diff_stats_deletions(commit_diff_stats);
+        *files_changed = git_diff_stats_files_changed(commit_diff_stats);
+        counted = true;
+      }
+    }
+  }
+
+  /* Whatever got that far, the libgit2 free functions take NULLs */
+  git_diff_stats_free(commit_diff_stats);
+  git_diff_free(commit_diff);
+  git_tree_free(commit_tree);
+  git_tree_free(commit_parent_tree);
+  git_commit_free(commit_parent);
+
+  return counted;
+}
+
+/*
+ * Finds the author's name and email in a raw commit object, without
+ * decoding it, trimmed the way libgit2 trims them. False if the header has
+ * no parseable author line.
+ */
+bool gitRawCommitAuthor(const char *data, size_t size,
+                        const char **name, size_t *name_length,
+                        const char **email, size_t *email_length)
+{
+  const char *end = data + size;
+  const char *line;
+
+  /* Header lines, up to the first empty one */
+  for (line = data; line < end && *line != '\n';)
+  {
+    const char *eol = memchr(line, '\n', end - line);
+
+    if (eol == NULL)
+      eol = end;
+
+    if (eol - line > 7 && strncmp(line, "author ", 7) == 0)
+    {
+      const char *lt = NULL, *gt = NULL;
+      const char *p;
+
+      /* Like libgit2, the last < and > of the line */
+      for (p = eol; p > line + 7; p--)
+      {
+        if (lt == NULL && p[-1] == '<')
+          lt = p - 1;
+        if (gt == NULL && p[-1] == '>')
+          gt = p - 1;
+      }
+
+      if (lt == NULL || gt == NULL || gt <= lt)
+        return false;
+
+      *name = line + 7;
+      *name_length = lt - (line + 7);
+      gitTrimIdentity(name, name_length);
+      *email = lt + 1;
+      *email_length = gt - (lt + 1);
+      gitTrimIdentity(email, email_length);
+      return true;
+    }
+
+    line = eol + 1;
+  }
+
+  return false;
+}
+
+/* Drops what libgit2 drops around names and emails: controls, spaces and some punctuation */
+static void gitTrimIdentity(const char **start, size_t *length)
+{
+  static const char crud[] = ".,:;<>\"\\'";
+
+  while (*length > 0 &&
+         ((unsigned char)(*start)[0] <= ' ' || strchr(crud, (*start)[0]) != NULL))
+  {
+    (*start)++;
+    (*length)--;
+  }
+
+  while (*length > 0 &&
+         ((unsigned char)(*start)[*length - 1] <= ' ' || strchr(crud, (*start)[*length - 1]) != NULL))
+    (*length)--;
+}
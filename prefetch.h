@@ -0,0 +1,46 @@
+/*
+ * A branch walked on a thread of its own, ahead of the rows asked for, so
+ * that asynchronous scans (PostgreSQL 14+) of several repositories overlap.
+ *
+ * The thread opens its own repository and hands over commits decoded as
+ * far as the scan fetches. Nothing it runs calls into PostgreSQL; errors
+ * are raised by the backend when it gets to them.
+ */
+typedef struct GitFdwPrefetch GitFdwPrefetch;
+
+/* What the thread did, merged into the scan's instrumentation */
+typedef struct GitFdwPrefetchCounters
+{
+  int64 commits_walked;
+  int64 commits_filtered;
+  int64 objects_looked_up;
+  int64 trees_diffed;
+  int64 commit_bytes;
+  instr_time revwalk;
+  instr_time commit_decode;
+  instr_time diff;
+} GitFdwPrefetchCounters;
+
+GitFdwPrefetch *gitPrefetchBegin(const char *path,
+                                 const git_oid *tip,
+                                 const git_oid *point,
+                                 bool mailmap,
+                                 GitFdwFetch fetch,
+                                 List *author_emails,
+                                 List *message_literals,
+                                 List *message_literals_ci,
+                                 bool timing,
+                                 const GitFdwPrefetchCounters *counters);
+pgsocket gitPrefetchSocket(GitFdwPrefetch *prefetch);
+bool gitPrefetchReady(GitFdwPrefetch *prefetch);
+const GitFdwCommitRow *gitPrefetchNext(GitFdwPrefetch *prefetch, int64 *walked, bool *done);
+void gitPrefetchCounters(GitFdwPrefetch *prefetch, GitFdwPrefetchCounters *counters);
+void gitPrefetchEnd(GitFdwPrefetch *prefetch);
+
+/* Used on both sides */
+bool gitDiffCounts(git_repository *repo, git_commit *commit,
+                   size_t *insertions, size_t *deletions, size_t *files_changed,
+                   int64 *objects_looked_up, int64 *trees_diffed);
+bool gitRawCommitAuthor(const char *data, size_t size,
+                        const char **name, size_t *name_length,
+                        const char **email, size_t *email_length);
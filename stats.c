@@ -0,0 +1,602 @@
+#include "postgres.h"
+
+#include <git2.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#if (PG_VERSION_NUM >= 170000)
+#include "storage/procnumber.h"
+#else
+#include "storage/backendid.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/tuplestore.h"
+#include "stats.h"
+
+PG_FUNCTION_INFO_V1(git_fdw_stat_repositories);
+PG_FUNCTION_INFO_V1(git_fdw_stat_reset);
+PG_FUNCTION_INFO_V1(git_fdw_stat_progress);
+
+Datum git_fdw_stat_repositories(PG_FUNCTION_ARGS);
+Datum git_fdw_stat_reset(PG_FUNCTION_ARGS);
+Datum git_fdw_stat_progress(PG_FUNCTION_ARGS);
+
+#define GIT_FDW_STAT_COLUMNS 10
+#define GIT_FDW_PROGRESS_COLUMNS 6
+#define BRANCH_NAME_LENGTH 256
+
+typedef struct GitFdwStatKey
+{
+  char path[MAXPGPATH];
+  char branch[BRANCH_NAME_LENGTH];
+} GitFdwStatKey;
+
+typedef struct GitFdwStatEntry
+{
+  GitFdwStatKey key; /* hash key, must be first */
+  slock_t mutex;     /* protects everything below */
+  int64 scans;
+  int64 rows;
+  int64 commits_diffed;
+  double diff_time;
+  int64 cache_hits;
+  int64 cache_misses;
+  int64 walks_avoided;  /* counts from the cache or from pack bitmaps */
+  git_oid tip;          /* last tip seen by a scan or a count */
+  git_oid counted_tip;  /* tip `commits` was computed for */
+  double commits;
+} GitFdwStatEntry;
+
+/* One per backend, only ever written by its owner */
+typedef struct GitFdwProgressSlot
+{
+  slock_t mutex;
+  int pid; /* 0 when idle */
+  GitFdwProgressPhase phase;
+  char path[MAXPGPATH];
+  char branch[BRANCH_NAME_LENGTH];
+  int64 done;
+  double total; /* estimate, 0 when unknown */
+} GitFdwProgressSlot;
+
+typedef struct GitFdwStatShared
+{
+  LWLock *lock; /* protects the hash table's layout */
+  int progress_slots;
+  GitFdwProgressSlot progress[FLEXIBLE_ARRAY_MEMBER];
+} GitFdwStatShared;
+
+static int git_fdw_max_repositories = 1000;
+
+static GitFdwStatShared *git_stats = NULL;
+static HTAB *git_stats_hash = NULL;
+static GitFdwProgressSlot *my_progress = NULL;
+static bool progress_callback_registered = false;
+
+#if (PG_VERSION_NUM >= 150000)
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void gitStatsShmemRequest(void);
+static void gitStatsShmemStartup(void);
+static Size gitStatsShmemSize(void);
+static int gitStatsProgressSlots(void);
+static GitFdwStatEntry *gitStatsAcquireEntry(const char *path, const char *branch);
+static void gitProgressXactCallback(XactEvent event, void *arg);
+
+void gitStatsInit(void)
+{
+  if (!process_shared_preload_libraries_in_progress)
+    return;
+
+  DefineCustomIntVariable("git_fdw.max_repositories",
+                          "Sets the maximum number of repository/branch pairs tracked by git_fdw.",
+                          NULL,
+                          &git_fdw_max_repositories,
+                          1000,
+                          10,
+                          INT_MAX,
+                          PGC_POSTMASTER,
+                          0,
+                          NULL,
+                          NULL,
+                          NULL);
+
+#if (PG_VERSION_NUM >= 150000)
+  MarkGUCPrefixReserved("git_fdw");
+
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = gitStatsShmemRequest;
+#else
+  EmitWarningsOnPlaceholders("git_fdw");
+
+  gitStatsShmemRequest();
+#endif
+
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = gitStatsShmemStartup;
+}
+
+bool gitStatsEnabled(void)
+{
+  return git_stats != NULL && git_stats_hash != NULL;
+}
+
+/*
+ * One progress slot per possible backend. MaxBackends is only computed once
+ * shared memory has been requested before PG 15, hence the arithmetic.
+ */
+static int gitStatsProgressSlots(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+  return MaxBackends;
+#elif (PG_VERSION_NUM >= 120000)
+  return MaxConnections + autovacuum_max_workers + 1 + max_worker_processes + max_wal_senders;
+#else
+  return MaxConnections + autovacuum_max_workers + 1 + max_worker_processes;
+#endif
+}
+
+static Size gitStatsShmemSize(void)
+{
+  Size size;
+
+  size = add_size(offsetof(GitFdwStatShared, progress),
+                  mul_size(gitStatsProgressSlots(), sizeof(GitFdwProgressSlot)));
+  size = MAXALIGN(size);
+  return add_size(size,
+                  hash_estimate_size(git_fdw_max_repositories, sizeof(GitFdwStatEntry)));
+}
+
+static void gitStatsShmemRequest(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+#endif
+
+  RequestAddinShmemSpace(gitStatsShmemSize());
+#if (PG_VERSION_NUM >= 90600)
+  RequestNamedLWLockTranche("git_fdw", 1);
+#else
+  RequestAddinLWLocks(1);
+#endif
+}
+
+static void gitStatsShmemStartup(void)
+{
+  bool found;
+  HASHCTL info;
+
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  git_stats = ShmemInitStruct("git_fdw",
+                              add_size(offsetof(GitFdwStatShared, progress),
+                                       mul_size(gitStatsProgressSlots(), sizeof(GitFdwProgressSlot))),
+                              &found);
+  if (!found)
+  {
+    int i;
+
+#if (PG_VERSION_NUM >= 90600)
+    git_stats->lock = &(GetNamedLWLockTranche("git_fdw"))->lock;
+#else
+    git_stats->lock = LWLockAssign();
+#endif
+    git_stats->progress_slots = gitStatsProgressSlots();
+    for (i = 0; i < git_stats->progress_slots; i++)
+    {
+      SpinLockInit(&git_stats->progress[i].mutex);
+      git_stats->progress[i].pid = 0;
+    }
+  }
+
+  memset(&info, 0, sizeof(info));
+  info.keysize = sizeof(GitFdwStatKey);
+  info.entrysize = sizeof(GitFdwStatEntry);
+#if (PG_VERSION_NUM >= 90500)
+  git_stats_hash = ShmemInitHash("git_fdw repositories",
+                                 git_fdw_max_repositories,
+                                 git_fdw_max_repositories,
+                                 &info,
+                                 HASH_ELEM | HASH_BLOBS);
+#else
+  info.hash = tag_hash;
+  git_stats_hash = ShmemInitHash("git_fdw repositories",
+                                 git_fdw_max_repositories,
+                                 git_fdw_max_repositories,
+                                 &info,
+                                 HASH_ELEM | HASH_FUNCTION);
+#endif
+
+  LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Find or create the entry for a repository/branch pair. Returns with the
+ * table lock held (the caller releases it), or NULL if the table is full.
+ */
+static GitFdwStatEntry *gitStatsAcquireEntry(const char *path, const char *branch)
+{
+  GitFdwStatKey key;
+  GitFdwStatEntry *entry;
+  bool found;
+
+  memset(&key, 0, sizeof(key));
+  strlcpy(key.path, path, sizeof(key.path));
+  strlcpy(key.branch, branch, sizeof(key.branch));
+
+  LWLockAcquire(git_stats->lock, LW_SHARED);
+  entry = (GitFdwStatEntry *)hash_search(git_stats_hash, &key, HASH_FIND, NULL);
+  if (entry != NULL)
+    return entry;
+
+  /* Creating an entry needs the exclusive lock */
+  LWLockRelease(git_stats->lock);
+  LWLockAcquire(git_stats->lock, LW_EXCLUSIVE);
+
+  entry = (GitFdwStatEntry *)hash_search(git_stats_hash, &key, HASH_ENTER_NULL, &found);
+  if (entry != NULL && !found)
+  {
+    memset(((char *)entry) + sizeof(GitFdwStatKey), 0, sizeof(GitFdwStatEntry) - sizeof(GitFdwStatKey));
+    SpinLockInit(&entry->mutex);
+  }
+
+  if (entry == NULL)
+    LWLockRelease(git_stats->lock);
+
+  return entry;
+}
+
+bool gitStatsLookupSize(const char *path, const char *branch, const git_oid *tip, double *rows)
+{
+  GitFdwStatEntry *entry;
+  bool hit;
+
+  if (!gitStatsEnabled())
+    return false;
+
+  entry = gitStatsAcquireEntry(path, branch);
+  if (entry == NULL)
+    return false;
+
+  SpinLockAcquire(&entry->mutex);
+  hit = !git_oid_iszero(&entry->counted_tip) && git_oid_equal(&entry->counted_tip, tip);
+  if (hit)
+  {
+    *rows = entry->commits;
+    entry->cache_hits++;
+    entry->walks_avoided++;
+  }
+  else
+  {
+    entry->cache_misses++;
+  }
+  git_oid_cpy(&entry->tip, tip);
+  SpinLockRelease(&entry->mutex);
+
+  LWLockRelease(git_stats->lock);
+  return hit;
+}
+
+void gitStatsStoreSize(const char *path, const char *branch, const git_oid *tip, double rows, bool walked)
+{
+  GitFdwStatEntry *entry;
+
+  if (!gitStatsEnabled())
+    return;
+
+  entry = gitStatsAcquireEntry(path, branch);
+  if (entry == NULL)
+    return;
+
+  SpinLockAcquire(&entry->mutex);
+  git_oid_cpy(&entry->counted_tip, tip);
+  entry->commits = rows;
+  if (!walked)
+    entry->walks_avoided++;
+  SpinLockRelease(&entry->mutex);
+
+  LWLockRelease(git_stats->lock);
+}
+
+void gitStatsReportScan(const char *path,
+                        const char *branch,
+                        const git_oid *tip,
+                        int64 rows,
+                        int64 commits_diffed,
+                        double diff_time)
+{
+  GitFdwStatEntry *entry;
+
+  if (!gitStatsEnabled())
+    return;
+
+  entry = gitStatsAcquireEntry(path, branch);
+  if (entry == NULL)
+    return;
+
+  SpinLockAcquire(&entry->mutex);
+  entry->scans++;
+  entry->rows += rows;
+  entry->commits_diffed += commits_diffed;
+  entry->diff_time += diff_time;
+  git_oid_cpy(&entry->tip, tip);
+  SpinLockRelease(&entry->mutex);
+
+  LWLockRelease(git_stats->lock);
+}
+
+/*
+ * Last known commit count for the branch, whatever the tip was back then.
+ * Good enough as the denominator of a progress report; 0 when unknown.
+ */
+double gitStatsEstimateSize(const char *path, const char *branch)
+{
+  GitFdwStatEntry *entry;
+  double rows;
+
+  if (!gitStatsEnabled())
+    return 0;
+
+  entry = gitStatsAcquireEntry(path, branch);
+  if (entry == NULL)
+    return 0;
+
+  SpinLockAcquire(&entry->mutex);
+  rows = entry->commits;
+  SpinLockRelease(&entry->mutex);
+
+  LWLockRelease(git_stats->lock);
+  return rows;
+}
+
+void gitProgressStart(GitFdwProgressPhase phase, const char *path, const char *branch, double total)
+{
+  int slot;
+
+  if (!gitStatsEnabled())
+    return;
+
+#if (PG_VERSION_NUM >= 170000)
+  slot = MyProcNumber;
+#else
+  slot = MyBackendId - 1;
+#endif
+  if (slot < 0 || slot >= git_stats->progress_slots)
+    return;
+
+  if (!progress_callback_registered)
+  {
+    /* Don't leave a stale report behind when the walk errors out */
+    RegisterXactCallback(gitProgressXactCallback, NULL);
+    progress_callback_registered = true;
+  }
+
+  my_progress = &git_stats->progress[slot];
+
+  SpinLockAcquire(&my_progress->mutex);
+  my_progress->pid = MyProcPid;
+  my_progress->phase = phase;
+  strlcpy(my_progress->path, path, sizeof(my_progress->path));
+  strlcpy(my_progress->branch, branch, sizeof(my_progress->branch));
+  my_progress->done = 0;
+  my_progress->total = total;
+  SpinLockRelease(&my_progress->mutex);
+}
+
+void gitProgressUpdate(int64 done)
+{
+  if (my_progress == NULL)
+    return;
+
+  SpinLockAcquire(&my_progress->mutex);
+  my_progress->done = done;
+  SpinLockRelease(&my_progress->mutex);
+}
+
+void gitProgressEnd(void)
+{
+  if (my_progress == NULL)
+    return;
+
+  SpinLockAcquire(&my_progress->mutex);
+  my_progress->pid = 0;
+  SpinLockRelease(&my_progress->mutex);
+  my_progress = NULL;
+}
+
+static void gitProgressXactCallback(XactEvent event, void *arg)
+{
+  if (event == XACT_EVENT_ABORT || event == XACT_EVENT_COMMIT)
+    gitProgressEnd();
+}
+
+Datum git_fdw_stat_repositories(PG_FUNCTION_ARGS)
+{
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  MemoryContext per_query_ctx;
+  MemoryContext oldcontext;
+  HASH_SEQ_STATUS hash_seq;
+  GitFdwStatEntry *entry;
+
+  if (!gitStatsEnabled())
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("git_fdw must be loaded via shared_preload_libraries")));
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("set-valued function called in context that cannot accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("materialize mode required, but it is not allowed in this context")));
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+  oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = tupdesc;
+
+  MemoryContextSwitchTo(oldcontext);
+
+  LWLockAcquire(git_stats->lock, LW_SHARED);
+
+  hash_seq_init(&hash_seq, git_stats_hash);
+  while ((entry = hash_seq_search(&hash_seq)) != NULL)
+  {
+    Datum values[GIT_FDW_STAT_COLUMNS];
+    bool nulls[GIT_FDW_STAT_COLUMNS];
+    GitFdwStatEntry tmp;
+    char tip[GIT_OID_HEXSZ + 1];
+    int i = 0;
+
+    SpinLockAcquire(&entry->mutex);
+    tmp = *entry;
+    SpinLockRelease(&entry->mutex);
+
+    memset(nulls, 0, sizeof(nulls));
+
+    values[i++] = CStringGetTextDatum(tmp.key.path);
+    values[i++] = CStringGetTextDatum(tmp.key.branch);
+    values[i++] = Int64GetDatum(tmp.scans);
+    values[i++] = Int64GetDatum(tmp.rows);
+    values[i++] = Int64GetDatum(tmp.commits_diffed);
+    values[i++] = Float8GetDatum(tmp.diff_time);
+    values[i++] = Int64GetDatum(tmp.cache_hits);
+    values[i++] = Int64GetDatum(tmp.cache_misses);
+    values[i++] = Int64GetDatum(tmp.walks_avoided);
+
+    if (git_oid_iszero(&tmp.tip))
+    {
+      nulls[i++] = true;
+    }
+    else
+    {
+      git_oid_tostr(tip, sizeof(tip), &tmp.tip);
+      values[i++] = CStringGetTextDatum(tip);
+    }
+
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+  }
+
+  LWLockRelease(git_stats->lock);
+
+  return (Datum)0;
+}
+
+Datum git_fdw_stat_reset(PG_FUNCTION_ARGS)
+{
+  HASH_SEQ_STATUS hash_seq;
+  GitFdwStatEntry *entry;
+
+  if (!gitStatsEnabled())
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("git_fdw must be loaded via shared_preload_libraries")));
+
+  LWLockAcquire(git_stats->lock, LW_EXCLUSIVE);
+
+  hash_seq_init(&hash_seq, git_stats_hash);
+  while ((entry = hash_seq_search(&hash_seq)) != NULL)
+  {
+    hash_search(git_stats_hash, &entry->key, HASH_REMOVE, NULL);
+  }
+
+  LWLockRelease(git_stats->lock);
+
+  PG_RETURN_VOID();
+}
+
+Datum git_fdw_stat_progress(PG_FUNCTION_ARGS)
+{
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  MemoryContext per_query_ctx;
+  MemoryContext oldcontext;
+  int i;
+
+  if (!gitStatsEnabled())
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("git_fdw must be loaded via shared_preload_libraries")));
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("set-valued function called in context that cannot accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("materialize mode required, but it is not allowed in this context")));
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+  oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = tupdesc;
+
+  MemoryContextSwitchTo(oldcontext);
+
+  for (i = 0; i < git_stats->progress_slots; i++)
+  {
+    static const char *const phases[] = {"counting commits", "scanning", "sampling"};
+    GitFdwProgressSlot *slot = &git_stats->progress[i];
+    GitFdwProgressSlot tmp;
+    Datum values[GIT_FDW_PROGRESS_COLUMNS];
+    bool nulls[GIT_FDW_PROGRESS_COLUMNS];
+    int column = 0;
+
+    SpinLockAcquire(&slot->mutex);
+    tmp = *slot;
+    SpinLockRelease(&slot->mutex);
+
+    if (tmp.pid == 0)
+      continue;
+
+    memset(nulls, 0, sizeof(nulls));
+
+    values[column++] = Int32GetDatum(tmp.pid);
+    values[column++] = CStringGetTextDatum(phases[tmp.phase]);
+    values[column++] = CStringGetTextDatum(tmp.path);
+    values[column++] = CStringGetTextDatum(tmp.branch);
+    values[column++] = Int64GetDatum(tmp.done);
+    if (tmp.total > 0)
+      values[column++] = Int64GetDatum((int64)tmp.total);
+    else
+      nulls[column++] = true;
+
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
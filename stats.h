@@ -0,0 +1,37 @@
+/*
+ * Cumulative, cluster-wide statistics per repository/branch.
+ *
+ * Only active when git_fdw is listed in shared_preload_libraries; every
+ * entry point is a no-op otherwise.
+ */
+void gitStatsInit(void);
+bool gitStatsEnabled(void);
+
+bool gitStatsLookupSize(const char *path, const char *branch, const git_oid *tip, double *rows);
+void gitStatsStoreSize(const char *path, const char *branch, const git_oid *tip, double rows, bool walked);
+
+void gitStatsReportScan(const char *path,
+                        const char *branch,
+                        const git_oid *tip,
+                        int64 rows,
+                        int64 commits_diffed,
+                        double diff_time);
+
+/*
+ * Per-backend progress of long walks, exposed through the
+ * git_fdw_stat_progress view.
+ */
+typedef enum GitFdwProgressPhase
+{
+  GIT_FDW_PROGRESS_COUNTING,
+  GIT_FDW_PROGRESS_SCANNING,
+  GIT_FDW_PROGRESS_SAMPLING
+} GitFdwProgressPhase;
+
+/* How many commits go by between two progress updates */
+#define GIT_FDW_PROGRESS_INTERVAL 1024
+
+double gitStatsEstimateSize(const char *path, const char *branch);
+void gitProgressStart(GitFdwProgressPhase phase, const char *path, const char *branch, double total);
+void gitProgressUpdate(int64 done);
+void gitProgressEnd(void);
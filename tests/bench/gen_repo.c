@@ -0,0 +1,333 @@
+/*
+ * gen_repo - build synthetic bare repositories for git_fdw benchmarks
+ *
+ * Usage:
+ *   gen_repo <path> [-c commits] [-f files] [-r refs] [-a authors]
+ *                   [-m merge_every] [-s seed]
+ *
+ * The repository is written with libgit2 only (no `git` binary needed) and
+ * packed at the end so scans hit pack files the way they do on a real
+ * server. `-m 0` produces a linear history; `-m N` forks a side branch
+ * every N commits and merges it back, which gives a merge-heavy shape.
+ *
+ * Files are spread over a two-level tree (dirNNN/fileNNNNN) so that large
+ * trees stay cheap to rebuild: only the directories touched by a commit
+ * get a new tree object.
+ *
+ * On success the program prints `key value` lines on stdout (tip sha1, a
+ * sha1 from the middle of the history, first/last commit times) that the
+ * benchmark driver uses to build its queries.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <git2.h>
+
+#define DIRS 64
+#define LINES_PER_FILE 32
+#define BASE_TIME 1500000000L
+#define TIME_STEP 3600L
+#define FILES_PER_COMMIT 3
+
+typedef struct gen_options
+{
+  const char *path;
+  int commits;
+  int files;
+  int refs;
+  int authors;
+  int merge_every;
+  unsigned int seed;
+} gen_options_t;
+
+typedef struct gen_state
+{
+  git_repository *repo;
+  gen_options_t *opts;
+  git_oid *blobs;     /* one blob per file */
+  int *revisions;     /* revision counter per file */
+  git_oid dirs[DIRS]; /* one tree per directory */
+  int dir_dirty[DIRS];
+  git_oid root;
+  long commit_count;
+} gen_state_t;
+
+static void check(int error, const char *what)
+{
+  const git_error *err;
+
+  if (error >= 0)
+    return;
+
+  err = giterr_last();
+  fprintf(stderr, "gen_repo: %s failed (%d): %s\n",
+          what, error, err ? err->message : "unknown error");
+  exit(1);
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr,
+          "usage: %s <path> [-c commits] [-f files] [-r refs] [-a authors]"
+          " [-m merge_every] [-s seed]\n",
+          progname);
+  exit(2);
+}
+
+static void write_blob(gen_state_t *state, int file)
+{
+  char *buffer;
+  size_t capacity = LINES_PER_FILE * 64;
+  size_t len = 0;
+  int line;
+  int revision = state->revisions[file];
+
+  buffer = malloc(capacity);
+  for (line = 0; line < LINES_PER_FILE; line++)
+  {
+    /*
+     * Only a couple of lines move with each revision, so per-commit diff
+     * stats look like real edits instead of full rewrites.
+     */
+    int line_revision = ((line % 8) == (revision % 8)) ? revision : 0;
+
+    len += snprintf(buffer + len, capacity - len,
+                    "file %d line %d rev %d\n", file, line, line_revision);
+  }
+
+  check(git_blob_create_frombuffer(&state->blobs[file], state->repo, buffer, len),
+        "git_blob_create_frombuffer");
+  free(buffer);
+}
+
+static void write_dir(gen_state_t *state, int dir)
+{
+  git_treebuilder *builder;
+  char name[32];
+  int file;
+
+  check(git_treebuilder_new(&builder, state->repo, NULL), "git_treebuilder_new");
+  for (file = dir; file < state->opts->files; file += DIRS)
+  {
+    snprintf(name, sizeof(name), "file%05d", file);
+    check(git_treebuilder_insert(NULL, builder, name, &state->blobs[file], GIT_FILEMODE_BLOB),
+          "git_treebuilder_insert");
+  }
+  check(git_treebuilder_write(&state->dirs[dir], builder), "git_treebuilder_write");
+  git_treebuilder_free(builder);
+  state->dir_dirty[dir] = 0;
+}
+
+static void write_root(gen_state_t *state)
+{
+  git_treebuilder *builder;
+  char name[16];
+  int dir;
+
+  check(git_treebuilder_new(&builder, state->repo, NULL), "git_treebuilder_new");
+  for (dir = 0; dir < DIRS && dir < state->opts->files; dir++)
+  {
+    if (state->dir_dirty[dir])
+      write_dir(state, dir);
+
+    snprintf(name, sizeof(name), "dir%03d", dir);
+    check(git_treebuilder_insert(NULL, builder, name, &state->dirs[dir], GIT_FILEMODE_TREE),
+          "git_treebuilder_insert");
+  }
+  check(git_treebuilder_write(&state->root, builder), "git_treebuilder_write");
+  git_treebuilder_free(builder);
+}
+
+static void touch_files(gen_state_t *state)
+{
+  int i;
+
+  for (i = 0; i < FILES_PER_COMMIT; i++)
+  {
+    int file = rand() % state->opts->files;
+
+    state->revisions[file]++;
+    write_blob(state, file);
+    state->dir_dirty[file % DIRS] = 1;
+  }
+  write_root(state);
+}
+
+static void make_commit(gen_state_t *state, git_oid *out, const git_oid *parents, int nparents)
+{
+  git_signature *signature;
+  git_tree *tree;
+  const git_commit *parent_commits[2];
+  git_commit *lookups[2];
+  char name[64], email[64], message[128];
+  int author = rand() % state->opts->authors;
+  int i;
+
+  snprintf(name, sizeof(name), "Author %d", author);
+  snprintf(email, sizeof(email), "author%d@example.com", author);
+  snprintf(message, sizeof(message), "Commit %ld\n\nSynthetic change JIRA-%ld\n",
+           state->commit_count, state->commit_count % 5000);
+
+  check(git_signature_new(&signature, name, email,
+                          BASE_TIME + state->commit_count * TIME_STEP, 0),
+        "git_signature_new");
+  check(git_tree_lookup(&tree, state->repo, &state->root), "git_tree_lookup");
+
+  for (i = 0; i < nparents; i++)
+  {
+    check(git_commit_lookup(&lookups[i], state->repo, &parents[i]), "git_commit_lookup");
+    parent_commits[i] = lookups[i];
+  }
+
+  check(git_commit_create(out, state->repo, NULL, signature, signature, NULL,
+                          message, tree, nparents, parent_commits),
+        "git_commit_create");
+
+  for (i = 0; i < nparents; i++)
+    git_commit_free(lookups[i]);
+  git_tree_free(tree);
+  git_signature_free(signature);
+  state->commit_count++;
+}
+
+static void pack_repository(gen_state_t *state)
+{
+  git_packbuilder *packbuilder;
+  git_revwalk *walker;
+  char pack_dir[4096];
+
+  check(git_packbuilder_new(&packbuilder, state->repo), "git_packbuilder_new");
+  check(git_revwalk_new(&walker, state->repo), "git_revwalk_new");
+  check(git_revwalk_push_glob(walker, "refs/*"), "git_revwalk_push_glob");
+  check(git_packbuilder_insert_walk(packbuilder, walker), "git_packbuilder_insert_walk");
+
+  snprintf(pack_dir, sizeof(pack_dir), "%sobjects/pack", git_repository_path(state->repo));
+  check(git_packbuilder_write(packbuilder, pack_dir, 0, NULL, NULL), "git_packbuilder_write");
+
+  git_revwalk_free(walker);
+  git_packbuilder_free(packbuilder);
+}
+
+int main(int argc, char **argv)
+{
+  gen_options_t opts = {NULL, 5000, 2000, 100, 50, 0, 42};
+  gen_state_t state;
+  git_oid *history;
+  git_oid tip, side;
+  char sha1[GIT_OID_HEXSZ + 1];
+  int opt, i, side_length = 0;
+
+  while ((opt = getopt(argc, argv, "c:f:r:a:m:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      opts.commits = atoi(optarg);
+      break;
+    case 'f':
+      opts.files = atoi(optarg);
+      break;
+    case 'r':
+      opts.refs = atoi(optarg);
+      break;
+    case 'a':
+      opts.authors = atoi(optarg);
+      break;
+    case 'm':
+      opts.merge_every = atoi(optarg);
+      break;
+    case 's':
+      opts.seed = (unsigned int)atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind != argc - 1 || opts.commits < 1 || opts.files < 1 || opts.authors < 1)
+    usage(argv[0]);
+
+  opts.path = argv[optind];
+  srand(opts.seed);
+  git_libgit2_init();
+
+  memset(&state, 0, sizeof(state));
+  state.opts = &opts;
+  state.blobs = calloc(opts.files, sizeof(git_oid));
+  state.revisions = calloc(opts.files, sizeof(int));
+  history = calloc(opts.commits, sizeof(git_oid));
+
+  check(git_repository_init(&state.repo, opts.path, 1), "git_repository_init");
+
+  for (i = 0; i < opts.files; i++)
+    write_blob(&state, i);
+  for (i = 0; i < DIRS; i++)
+    state.dir_dirty[i] = 1;
+  write_root(&state);
+
+  make_commit(&state, &tip, NULL, 0);
+  history[0] = tip;
+
+  for (i = 1; i < opts.commits; i++)
+  {
+    touch_files(&state);
+
+    if (opts.merge_every > 0 && side_length > 0 && (i % opts.merge_every) == 0)
+    {
+      git_oid parents[2];
+
+      parents[0] = tip;
+      parents[1] = side;
+      make_commit(&state, &tip, parents, 2);
+      side_length = 0;
+    }
+    else if (opts.merge_every > 0 && (i % opts.merge_every) >= opts.merge_every / 2)
+    {
+      /* Second half of each merge window goes on the side branch */
+      make_commit(&state, &side, side_length ? &side : &tip, 1);
+      side_length++;
+      history[i] = side;
+      continue;
+    }
+    else
+    {
+      make_commit(&state, &tip, &tip, 1);
+    }
+    history[i] = tip;
+  }
+
+  check(git_reference_create(NULL, state.repo, "refs/heads/master", &tip, 1, NULL),
+        "git_reference_create");
+  check(git_repository_set_head(state.repo, "refs/heads/master"), "git_repository_set_head");
+
+  for (i = 0; i < opts.refs; i++)
+  {
+    char ref_name[64];
+    const git_oid *target = &history[((long)i * opts.commits) / (opts.refs ? opts.refs : 1)];
+
+    snprintf(ref_name, sizeof(ref_name), "refs/heads/topic-%d", i);
+    check(git_reference_create(NULL, state.repo, ref_name, target, 1, NULL),
+          "git_reference_create");
+    snprintf(ref_name, sizeof(ref_name), "refs/tags/v%d", i);
+    check(git_reference_create(NULL, state.repo, ref_name, target, 1, NULL),
+          "git_reference_create");
+  }
+
+  pack_repository(&state);
+
+  git_oid_tostr(sha1, sizeof(sha1), &tip);
+  printf("tip %s\n", sha1);
+  git_oid_tostr(sha1, sizeof(sha1), &history[opts.commits / 2]);
+  printf("middle %s\n", sha1);
+  printf("commits %ld\n", state.commit_count);
+  printf("first_time %ld\n", BASE_TIME);
+  printf("last_time %ld\n", BASE_TIME + (state.commit_count - 1) * TIME_STEP);
+
+  free(history);
+  free(state.revisions);
+  free(state.blobs);
+  git_repository_free(state.repo);
+  git_libgit2_shutdown();
+  return 0;
+}
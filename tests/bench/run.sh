@@ -0,0 +1,133 @@
+#!/usr/bin/env bash
+#
+# Benchmark driver for git_fdw scans.
+#
+# Builds synthetic repositories with tests/bench/gen_repo, exposes each one
+# as a foreign table and times a fixed set of queries. Results are written
+# as JSON lines (one object per query and iteration) to $BENCH_OUTPUT.
+#
+# The server must be able to read $BENCH_DIR and have git_fdw installed.
+#
+# Tunables (environment):
+#   PSQL             psql invocation           (default: psql)
+#   BENCH_DIR        where repositories go     (default: /tmp/git_fdw_bench)
+#   BENCH_OUTPUT     results file              (default: bench_output.txt)
+#   BENCH_COMMITS    commits per repository    (default: 5000)
+#   BENCH_FILES      files in each tree        (default: 2000)
+#   BENCH_REFS       extra branches and tags   (default: 100)
+#   BENCH_MERGE      merge window for the merge-heavy shape (default: 10)
+#   BENCH_ITERATIONS runs per query            (default: 3)
+#   BENCH_BITMAPS    write pack bitmaps with `git repack -adb` when git is
+#                    installed, 0 to benchmark without them (default: 1)
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+
+PSQL=${PSQL:-psql}
+BENCH_DIR=${BENCH_DIR:-/tmp/git_fdw_bench}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+BENCH_COMMITS=${BENCH_COMMITS:-5000}
+BENCH_FILES=${BENCH_FILES:-2000}
+BENCH_REFS=${BENCH_REFS:-100}
+BENCH_MERGE=${BENCH_MERGE:-10}
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-3}
+BENCH_BITMAPS=${BENCH_BITMAPS:-1}
+
+function psql_exec {
+  $PSQL -qAtX -v ON_ERROR_STOP=1 -c "$1"
+}
+
+function now_ms {
+  echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Prints "planning execution" in milliseconds for one query
+function explain_times {
+  psql_exec "EXPLAIN (ANALYZE, FORMAT JSON) $1" |
+    tr -d ' \n' |
+    sed -E 's/.*"PlanningTime":([0-9.]+).*"ExecutionTime":([0-9.]+).*/\1 \2/'
+}
+
+function emit {
+  echo "{\"repository\":\"$1\",\"query\":\"$2\",\"iteration\":$3,\"planning_ms\":$4,\"execution_ms\":$5}" >> "$BENCH_OUTPUT"
+}
+
+function bench_query {
+  local repository=$1 name=$2 query=$3 i times
+
+  for i in $(seq 1 "$BENCH_ITERATIONS"); do
+    times=$(explain_times "$query")
+    emit "$repository" "$name" "$i" "${times% *}" "${times#* }"
+  done
+}
+
+function bench_analyze {
+  local repository=$1 table=$2 i start
+
+  for i in $(seq 1 "$BENCH_ITERATIONS"); do
+    start=$(now_ms)
+    psql_exec "ANALYZE $table"
+    emit "$repository" "analyze" "$i" 0 $(( $(now_ms) - start ))
+  done
+}
+
+function bench_repository {
+  local shape=$1 merge_every=$2
+  local repository="$shape-$BENCH_COMMITS"
+  local path="$BENCH_DIR/$repository.git"
+  local table="git_fdw_bench.${shape}_repository"
+  local key value tip middle first_time last_time
+
+  rm -rf "$path"
+  while read -r key value; do
+    case $key in
+      tip) tip=$value ;;
+      middle) middle=$value ;;
+      first_time) first_time=$value ;;
+      last_time) last_time=$value ;;
+    esac
+  done < <("$here/gen_repo" "$path" -c "$BENCH_COMMITS" -f "$BENCH_FILES" \
+                                   -r "$BENCH_REFS" -m "$merge_every")
+
+  if [ "$BENCH_BITMAPS" != "0" ] && command -v git > /dev/null; then
+    git -C "$path" repack -adbq
+  fi
+
+  psql_exec "IMPORT FOREIGN SCHEMA git_data FROM SERVER git_fdw_bench_server
+               INTO git_fdw_bench
+               OPTIONS (path '$path', branch 'refs/heads/master', prefix '${shape}_')"
+
+  local range_from=$(( first_time + (last_time - first_time) / 4 ))
+  local range_to=$(( first_time + (last_time - first_time) / 2 ))
+
+  bench_query "$repository" "count" \
+    "SELECT count(*) FROM $table"
+  bench_query "$repository" "point_lookup" \
+    "SELECT * FROM $table WHERE sha1 = '$middle'"
+  bench_query "$repository" "date_range" \
+    "SELECT sha1 FROM $table WHERE commit_date BETWEEN to_timestamp($range_from) AND to_timestamp($range_to)"
+  bench_query "$repository" "diff_stat_aggregate" \
+    "SELECT sum(insertions), sum(deletions), sum(files_changed) FROM $table"
+  bench_query "$repository" "commit_count" \
+    "SELECT git_fdw_commit_count('$table', 'refs/heads/master', '$middle')"
+  bench_query "$repository" "planning" \
+    "SELECT * FROM $table LIMIT 0"
+  bench_analyze "$repository" "$table"
+}
+
+mkdir -p "$BENCH_DIR"
+: > "$BENCH_OUTPUT"
+
+psql_exec "CREATE EXTENSION IF NOT EXISTS git_fdw"
+psql_exec "DROP SERVER IF EXISTS git_fdw_bench_server CASCADE"
+psql_exec "DROP SCHEMA IF EXISTS git_fdw_bench CASCADE"
+psql_exec "CREATE SERVER git_fdw_bench_server FOREIGN DATA WRAPPER git_fdw"
+psql_exec "CREATE SCHEMA git_fdw_bench"
+
+bench_repository linear 0
+bench_repository merge "$BENCH_MERGE"
+
+psql_exec "DROP SCHEMA git_fdw_bench CASCADE"
+psql_exec "DROP SERVER git_fdw_bench_server CASCADE"
+
+echo "Results written to $BENCH_OUTPUT"
@@ -7,6 +7,9 @@ pg_ctlcluster $1 my_cluster start
 # Clone git_fdw's repo
 git clone --bare https://github.com/franckverrot/git_fdw.git /git_fdw/repo.git
 
+# With pack bitmaps, for git_fdw_commit_count
+git -C /git_fdw/repo.git repack -adb
+
 # Setup Postgres
 exec_psql /git_fdw/tests/setup.sql
 exec_psql /git_fdw/tests/setups/$1.sql
@@ -11,4 +11,104 @@ FROM
 WHERE
   sha1 like '4fc2faf9%';
 
+SELECT
+  count(*)
+FROM
+  git_repos.rails_repository
+WHERE
+  sha1 like '4fc2faf9%';
+
+SELECT
+  count(*) > 0 AS found
+FROM
+  git_repos.rails_grep
+WHERE
+  sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+  pattern = 'git_fdw' AND
+  path LIKE 'git_fdw%';
+
+SELECT
+  (SELECT count(*)
+     FROM git_repos.rails_grep
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          pattern = 'git_f[d]w' AND
+          path LIKE 'git_fdw%') =
+  (SELECT count(*)
+     FROM git_repos.rails_grep
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          pattern = 'git_fdw' AND
+          path LIKE 'git_fdw%') AS regex_matches_literal,
+  (SELECT count(*) > 0
+     FROM git_repos.rails_grep
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          pattern = '^#include "[a-z_]+\.h"' AND
+          path LIKE 'git_fdw%') AS regex_found;
+
+SELECT
+  count(DISTINCT commit_sha1) AS blamed_commits,
+  count(*) > 0 AS has_lines
+FROM
+  git_repos.rails_blame
+WHERE
+  sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+  path = 'Makefile';
+
+SELECT
+  sha1,
+  insertions,
+  deletions,
+  files_changed
+FROM
+  git_fdw_range('git_repos.rails_repository', NULL, '4fc2faf9a0d051dc5c15a4821f1b790609b3074e');
+
+SELECT
+  count(*) AS empty_range
+FROM
+  git_fdw_range('git_repos.rails_repository',
+                '4fc2faf9a0d051dc5c15a4821f1b790609b3074e',
+                '4fc2faf9a0d051dc5c15a4821f1b790609b3074e');
+
+SELECT
+  *
+FROM
+  git_fdw_range_diff('git_repos.rails_repository', NULL, '4fc2faf9a0d051dc5c15a4821f1b790609b3074e');
+
+SELECT
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          message LIKE 'Initial%') AS message_like,
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          message ~* '^INITIAL commit') AS message_regex,
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE message LIKE '%zz-no-such-message-zz%') AS no_match;
+
+SELECT
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE sha1 = '4fc2faf9a0d051dc5c15a4821f1b790609b3074e' AND
+          author_email = 'franck@verrot.fr') AS by_author,
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE author_email = 'franck@verrot.fr') =
+  (SELECT count(*)
+     FROM git_repos.rails_repository
+    WHERE author_email || '' = 'franck@verrot.fr') AS same_as_recheck;
+
+SELECT
+  git_fdw_commit_count('git_repos.rails_repository',
+                       '4fc2faf9a0d051dc5c15a4821f1b790609b3074e') AS root_count,
+  git_fdw_commit_count('git_repos.rails_repository',
+                       '4fc2faf9a0d051dc5c15a4821f1b790609b3074e',
+                       '4fc2faf9a0d051dc5c15a4821f1b790609b3074e') AS empty_count,
+  git_fdw_commit_count('git_repos.rails_repository', 'refs/heads/master') =
+    (SELECT count(*) FROM git_repos.rails_repository) AS branch_count,
+  git_fdw_commit_count('git_repos.rails_repository',
+                       'refs/heads/master',
+                       '4fc2faf9a0d051dc5c15a4821f1b790609b3074e') =
+    (SELECT count(*) - 1 FROM git_repos.rails_repository) AS excluded_count;
+
 ANALYZE VERBOSE git_repos.rails_repository;
\ No newline at end of file
@@ -5,6 +5,9 @@ CREATE FOREIGN TABLE
         name          text,
         email         text,
         commit_date   timestamp with time zone,
+        author_name   text,
+        author_email  text,
+        author_date   timestamp with time zone,
         insertions    int,
         deletions     int,
         files_changed int
@@ -15,3 +18,38 @@ OPTIONS (
     branch 'refs/heads/master',
     git_search_path '/optional/custom/search_path'
   );
+
+CREATE FOREIGN TABLE
+  git_repos.rails_grep (
+        sha1          text,
+        pattern       text,
+        path          text,
+        line_no       int,
+        line          text
+    )
+SERVER git_fdw_server
+OPTIONS (
+    path '/git_fdw/repo.git',
+    branch 'refs/heads/master',
+    git_search_path '/optional/custom/search_path',
+    kind 'grep'
+  );
+
+CREATE FOREIGN TABLE
+  git_repos.rails_blame (
+        sha1          text,
+        path          text,
+        line_no       int,
+        line          text,
+        commit_sha1   text,
+        author_name   text,
+        author_email  text,
+        commit_date   timestamp with time zone
+    )
+SERVER git_fdw_server
+OPTIONS (
+    path '/git_fdw/repo.git',
+    branch 'refs/heads/master',
+    git_search_path '/optional/custom/search_path',
+    kind 'blame'
+  );